@@ -0,0 +1,370 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * Benchmarks of the clone detector's performance-critical phases
+ * on a synthetic corpus
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "CloneDetector.h"
+#include "OutputWriter.h"
+#include "TokenCompare.h"
+#include "TokenContainer.h"
+
+typedef std::vector<FileData::token_type> line_type;
+typedef std::vector<line_type> lines_type;
+
+/*
+ * Generator of a corpus resembling tokenized C-like code:
+ * lines of frequent tokens, nested brace-delimited blocks,
+ * code snippets shared among files, and some copied files.
+ */
+class CorpusGenerator {
+    std::mt19937 random;
+
+    // Return a random number in [0, n)
+    unsigned uniform(unsigned n) { return random() % n; }
+
+    line_type random_line() {
+        static const FileData::token_type common[] = {
+            999, 999, 999, 40, 41, 59, 61, 46, 44, 362, 998, 830, 870};
+        static const unsigned lengths[] = {0, 1, 2, 3, 4, 5, 6, 8, 10};
+
+        line_type line(lengths[uniform(sizeof(lengths) / sizeof(*lengths))]);
+        for (auto& t : line)
+            t = uniform(10) ? common[uniform(sizeof(common) / sizeof(*common))]
+                : uniform(2000);
+        return line;
+    }
+
+    void append_block(lines_type &lines, int depth = 0) {
+        lines.push_back(random_line());
+        lines.back().push_back('{');
+        for (unsigned n = 1 + uniform(6); n > 0; n--)
+            if (depth < 2 && uniform(5) == 0)
+                append_block(lines, depth + 1);
+            else
+                lines.push_back(random_line());
+        lines.push_back(line_type{'}'});
+    }
+
+public:
+    CorpusGenerator(unsigned seed = 1) : random(seed) {}
+
+    // Return the text-format tokens of nfiles files
+    std::string generate(unsigned nfiles) {
+        std::vector<lines_type> snippets(200);
+        for (auto& s : snippets)
+            append_block(s);
+
+        std::vector<lines_type> files;
+        std::ostringstream out;
+        for (unsigned i = 0; i < nfiles; i++) {
+            lines_type body;
+            if (!files.empty() && uniform(100) < 3)
+                body = files[uniform(files.size())];
+            else {
+                for (unsigned n = 3 + uniform(38); n > 0; n--)
+                    if (uniform(10) < 3) {
+                        const auto& s = snippets[uniform(snippets.size())];
+                        body.insert(body.end(), s.begin(), s.end());
+                    } else if (uniform(2))
+                        append_block(body);
+                    else
+                        body.push_back(random_line());
+                files.push_back(body);
+            }
+
+            out << "Fdir" << i % 17 << "/file" << i << ".c\n";
+            for (const auto& line : body) {
+                for (std::size_t j = 0; j < line.size(); j++)
+                    out << (j ? " " : "") << line[j];
+                out << '\n';
+            }
+        }
+        return out.str();
+    }
+
+    /*
+     * Return the text-format tokens of ncopies copies of a file with
+     * nlines lines, resembling a vendored source file.
+     * Each copy has a few of its lines locally modified, so that
+     * it shares long clones with the others.
+     */
+    std::string generate_copies(unsigned ncopies, unsigned nlines) {
+        lines_type original;
+        while (original.size() < nlines)
+            if (uniform(2))
+                append_block(original);
+            else
+                original.push_back(random_line());
+
+        std::ostringstream out;
+        for (unsigned i = 0; i < ncopies; i++) {
+            out << "Fvendor" << i << "/file.c\n";
+            for (const auto& original_line : original) {
+                line_type line(uniform(5000) ? original_line : random_line());
+                for (std::size_t j = 0; j < line.size(); j++)
+                    out << (j ? " " : "") << line[j];
+                out << '\n';
+            }
+        }
+        return out.str();
+    }
+};
+
+// Return the number of seconds elapsed since the specified time point
+static double
+seconds_since(std::chrono::steady_clock::time_point begin)
+{
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - begin;
+    return d.count();
+}
+
+// Time the indexing and pruning of clone candidates with each engine
+static void
+bench_index(const TokenContainer &tc, unsigned clone_length,
+        unsigned nthreads)
+{
+    static const struct {
+        const char *name;
+        IndexEngine engine;
+    } engines[] = {
+        {"map", IndexEngine::map},
+        {"hash", IndexEngine::hash},
+        {"sort", IndexEngine::sort},
+        {"suffix", IndexEngine::suffix},
+    };
+
+    double map_time = 0;
+    for (const auto& e : engines) {
+        DetectorOptions options;
+        options.engine = e.engine;
+        options.nthreads = nthreads;
+
+        auto begin = std::chrono::steady_clock::now();
+        CloneDetector cd(tc, clone_length, options);
+        cd.prune_non_clones();
+        double t = seconds_since(begin);
+        if (e.engine == IndexEngine::map)
+            map_time = t;
+
+        std::cout << "index " << e.name << ": " << t << " s, "
+            << cd.get_number_of_seen_sites() << " sites, "
+            << map_time / t << "x map" << std::endl;
+    }
+}
+
+// Time the extension of clones on a corpus with very long clones
+static void
+bench_extend(unsigned clone_length, unsigned nthreads)
+{
+    std::istringstream corpus(CorpusGenerator().generate_copies(20, 10000));
+    TokenContainer tc(corpus);
+
+    DetectorOptions options;
+    options.engine = IndexEngine::hash;
+    options.nthreads = nthreads;
+    CloneDetector cd(tc, clone_length, options);
+    cd.prune_non_clones();
+    cd.create_line_region_clones();
+
+    auto begin = std::chrono::steady_clock::now();
+    cd.extend_clones();
+    double t = seconds_since(begin);
+
+    std::cout << "extend: " << t << " s, "
+        << cd.get_number_of_clone_groups() << " groups, "
+        << cd.get_number_of_clones() << " clones, "
+        << cd.get_number_of_clone_tokens() << " clone tokens" << std::endl;
+}
+
+// Time the creation of block clones on a corpus with very long clones
+static void
+bench_blocks(unsigned clone_length, unsigned nthreads)
+{
+    std::istringstream corpus(CorpusGenerator().generate_copies(20, 10000));
+    TokenContainer tc(corpus);
+
+    DetectorOptions options;
+    options.engine = IndexEngine::hash;
+    options.nthreads = nthreads;
+    CloneDetector cd(tc, clone_length, options);
+    cd.prune_non_clones();
+
+    auto begin = std::chrono::steady_clock::now();
+    cd.create_block_region_clones();
+    double t = seconds_since(begin);
+
+    std::cout << "blocks: " << t << " s, "
+        << cd.get_number_of_clone_groups() << " groups, "
+        << cd.get_number_of_clones() << " clones" << std::endl;
+}
+
+// Time the reporting of the clones found in the corpus in each format
+static void
+bench_report(const TokenContainer &tc, unsigned clone_length,
+        unsigned nthreads)
+{
+    DetectorOptions options;
+    options.engine = IndexEngine::hash;
+    options.nthreads = nthreads;
+    CloneDetector cd(tc, clone_length, options);
+    cd.prune_non_clones();
+    cd.create_line_region_clones();
+    cd.extend_clones();
+    cd.remove_shadowed_groups();
+
+    int fd = open("/dev/null", O_WRONLY);
+    const std::pair<const char *, ReportFormat> formats[] = {
+        {"text", ReportFormat::text},
+        {"json", ReportFormat::json},
+        {"ndjson", ReportFormat::ndjson},
+        {"binary", ReportFormat::binary},
+        {"pairs", ReportFormat::pairs},
+        {"binary-pairs", ReportFormat::binary_pairs},
+    };
+    for (const auto& format : formats) {
+        OutputWriter out(fd);
+        ReportOptions report_options;
+        report_options.format = format.second;
+        auto begin = std::chrono::steady_clock::now();
+        cd.report(out, report_options);
+        out.flush();
+        double t = seconds_since(begin);
+
+        std::cout << "report " << format.first << ": "
+            << t << " s, " << out.size() / 1e6 / t << " MB/s, "
+            << cd.get_number_of_clones() << " clones" << std::endl;
+    }
+    close(fd);
+}
+
+/*
+ * Time each token comparison kernel, and any one specialized for
+ * the length, on equal sequences of typical lengths
+ */
+static void
+bench_compare()
+{
+    const std::size_t NPAIRS = 1024;
+    const unsigned ROUNDS = 4096;
+
+    std::vector<TokenKernel> kernels(supported_token_kernels());
+    // The generic algorithm previously used
+    kernels.insert(kernels.begin(), TokenKernel{"std::mismatch",
+            [](const FileData::token_type *a, const FileData::token_type *b,
+                std::size_t n) -> std::size_t {
+        return std::mismatch(a, a + n, b).first - a;
+    }, nullptr});
+
+    std::mt19937 random;
+    for (unsigned length : {15, 20, 30, 40, 50, 100}) {
+        // Successive pairs start at varying alignments
+        std::vector<FileData::token_type> a(NPAIRS * length);
+        for (auto& t : a)
+            t = random() % 1000;
+        std::vector<FileData::token_type> b(a);
+
+        // Time the general kernel, and the one specialized for the length
+        for (const auto& kernel : kernels)
+            for (int fixed = 0; fixed <= 1; fixed++) {
+                token_mismatch_type mismatch = kernel.mismatch;
+                if (fixed && !(kernel.fixed && (mismatch = kernel.fixed(length))))
+                    continue;
+
+                auto begin = std::chrono::steady_clock::now();
+                std::size_t sum = 0;
+                for (unsigned r = 0; r < ROUNDS; r++)
+                    for (std::size_t i = 0; i < a.size(); i += length)
+                        sum += mismatch(&a[i], &b[i], length);
+                double t = seconds_since(begin);
+                if (sum != std::size_t(ROUNDS) * a.size())
+                    std::cerr << kernel.name << ": wrong result" << std::endl;
+
+                std::cout << "compare " << length << " tokens " << kernel.name
+                    << (fixed ? " fixed" : "") << ": "
+                    << t * 1e9 / ROUNDS / NPAIRS << " ns" << std::endl;
+            }
+    }
+}
+
+int
+main(int argc, char * const argv[])
+{
+    int opt;
+    unsigned nfiles = 20000;
+    unsigned clone_length = 15;
+    unsigned nthreads = 1;
+
+    while ((opt = getopt(argc, argv, "f:n:t:")) != -1)
+        switch (opt) {
+        case 'f':
+            nfiles = std::atoi(optarg);
+            break;
+        case 'n':
+            clone_length = std::atoi(optarg);
+            break;
+        case 't':
+            nthreads = std::atoi(optarg);
+            break;
+        default: /* ? */
+            std::cerr << "Usage: " << argv[0] <<
+                " [-f files] [-n tokens] [-t threads] [benchmark ...]" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+    auto begin = std::chrono::steady_clock::now();
+    std::istringstream corpus(CorpusGenerator().generate(nfiles));
+    TokenContainer tc(corpus);
+    std::cout << "Generated " << tc.file_size() << " files, "
+        << tc.token_size() << " tokens in " << seconds_since(begin) << " s"
+        << std::endl;
+
+    // Run the named benchmarks, or all of them
+    auto selected = [&](const char *name) {
+        if (optind == argc)
+            return true;
+        for (int i = optind; i < argc; i++)
+            if (strcmp(argv[i], name) == 0)
+                return true;
+        return false;
+    };
+
+    if (selected("index"))
+        bench_index(tc, clone_length, nthreads);
+    if (selected("extend"))
+        bench_extend(clone_length, nthreads);
+    if (selected("blocks"))
+        bench_blocks(clone_length, nthreads);
+    if (selected("report"))
+        bench_report(tc, clone_length, nthreads);
+    if (selected("compare"))
+        bench_compare();
+    exit(EXIT_SUCCESS);
+}
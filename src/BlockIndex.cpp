@@ -0,0 +1,106 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * An index of the matching delimiters of code blocks
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "BlockIndex.h"
+#include "Parallel.h"
+
+/*
+ * Match the delimiters of the file with a stack of open blocks.
+ * Closing delimiters without an open block, and blocks still open
+ * at the file's end, are ignored.
+ */
+void
+BlockIndex::find_blocks(const FileData &file)
+{
+    auto tokens = file.offset_begin(0);
+    file_blocks.clear();
+    open_blocks.clear();
+    for (std::size_t i = 0; i < file.token_size(); i++)
+        if (tokens[i] == open) {
+            open_blocks.push_back(file_blocks.size());
+            file_blocks.push_back(Block{token_offset_type(i), 0});
+        } else if (tokens[i] == close && !open_blocks.empty()) {
+            file_blocks[open_blocks.back()].close = token_offset_type(i);
+            open_blocks.pop_back();
+        }
+
+    // Blocks remaining open at the file's end have no match
+    for (auto b : open_blocks)
+        file_blocks[b].close = file_blocks[b].open;
+
+    std::vector<Word> file_words((file.token_size() + 63) / 64, Word{0, 0});
+    for (const auto& block : file_blocks)
+        if (block.close != block.open) {
+            file_words[block.open / 64].opens |=
+                std::uint64_t(1) << (block.open % 64);
+            closes.push_back(block.close);
+        }
+    closes.end_group();
+
+    token_offset_type rank = 0;
+    for (auto& word : file_words) {
+        word.rank = rank;
+        rank += __builtin_popcountll(word.opens);
+        words.push_back(word);
+    }
+    words.end_group();
+}
+
+/*
+ * Files are processed in parallel tasks, whose blocks are then
+ * appended in file order.
+ */
+BlockIndex::BlockIndex(const TokenContainer &tc, FileData::token_type open,
+        FileData::token_type close, unsigned nthreads) :
+    open(open), close(close)
+{
+    const std::size_t nfiles = tc.file_size();
+    const std::size_t ntasks = nthreads > 1
+        ? std::min<std::size_t>(nfiles, 64 * nthreads)
+        : std::min<std::size_t>(nfiles, 1);
+    std::vector<BlockIndex> task_index(ntasks, BlockIndex(open, close));
+    parallel_for(nthreads, ntasks, [&](std::size_t task) {
+        std::size_t end = nfiles * (task + 1) / ntasks;
+        for (std::size_t f = nfiles * task / ntasks; f < end; f++)
+            task_index[task].find_blocks(tc.get_file(f));
+    });
+
+    for (auto& ti : task_index) {
+        closes.append(ti.closes);
+        words.append(ti.words);
+    }
+}
+
+std::size_t
+BlockIndex::block_end(TokenContainer::file_id_type file_id,
+        FileData::token_offset_type open) const
+{
+    auto file_words = words[file_id];
+    if (open / 64 >= file_words.size())
+        return NO_BLOCK_END;
+    const Word &word = file_words.begin()[open / 64];
+    std::uint64_t bit = std::uint64_t(1) << (open % 64);
+    if (!(word.opens & bit))
+        return NO_BLOCK_END;
+    return closes[file_id].begin()[word.rank
+        + __builtin_popcountll(word.opens & (bit - 1))];
+}
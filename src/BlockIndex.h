@@ -0,0 +1,99 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * An index of the matching delimiters of code blocks
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "GroupedVector.h"
+#include "TokenContainer.h"
+
+/*
+ * The positions of each file's matched block delimiters, found
+ * through a single pass over its tokens, so that the end of
+ * any block can be looked up without scanning its contents.
+ * The closing offsets are looked up in constant time through a
+ * bitmap of the opening offsets, which has a count of the blocks
+ * opened before each of its words.  This takes two bits per token,
+ * rather than the four bytes a closing offset per token would need.
+ */
+class BlockIndex {
+public:
+    typedef unsigned int token_offset_type;
+
+    // Returned when a block has no matching end
+    static const std::size_t NO_BLOCK_END = std::size_t(-1);
+
+private:
+    // Opening offsets of matched blocks in 64 tokens
+    struct Word {
+        std::uint64_t opens;
+        // Number of the file's blocks opened before these tokens
+        token_offset_type rank;
+    };
+
+    // Tokens opening and closing blocks
+    FileData::token_type open, close;
+
+    // Each file's closing offsets, in order of their opening offset
+    GroupedVector<token_offset_type> closes;
+
+    // Each file's bitmap of opening offsets
+    GroupedVector<Word> words;
+
+    // Blocks of the file being indexed, and the indices of open ones
+    struct Block {
+        token_offset_type open;
+        token_offset_type close;
+    };
+    std::vector<Block> file_blocks;
+    std::vector<std::size_t> open_blocks;
+
+    // Add the matched blocks of the specified file
+    void find_blocks(const FileData &file);
+
+public:
+    // Construct an index of the blocks delimited by the specified tokens
+    BlockIndex(FileData::token_type open, FileData::token_type close) :
+        open(open), close(close) {}
+
+    // Construct an index of the blocks of all files
+    BlockIndex(const TokenContainer &tc, FileData::token_type open,
+            FileData::token_type close, unsigned nthreads = 1);
+
+    // Add the blocks of the file following the already indexed ones
+    void index_file(const FileData &file) {
+        find_blocks(file);
+    }
+
+    /*
+     * Return the offset of the token closing the block opened at the
+     * specified offset of the specified file, or NO_BLOCK_END if the
+     * block is not closed in the file
+     */
+    std::size_t block_end(TokenContainer::file_id_type file_id,
+            FileData::token_offset_type open) const;
+
+    // Return the number of indexed files
+    std::size_t file_size() const { return closes.size(); }
+
+    // Return the number of matched blocks
+    std::size_t size() const { return closes.element_size(); }
+};
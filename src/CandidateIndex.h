@@ -0,0 +1,90 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * The interface of alternative clone candidate indexing engines
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#include "CloneDetector.h"
+#include "TokenContainer.h"
+#include "WindowHasher.h"
+#include "WindowSketch.h"
+
+/*
+ * An index of the token windows starting at file lines.
+ * Once all files have been indexed, the windows seen more than once
+ * are moved into the clone detector's candidate map, which orders them
+ * by their tokens; clone creation then proceeds from there.
+ */
+class CandidateIndex {
+public:
+    virtual ~CandidateIndex() {}
+
+    // Add the windows starting at the file's lines
+    virtual void index_file(const FileData &file) = 0;
+
+    /*
+     * Add only the windows the sketch reports as seen at least twice.
+     * Engines that do not support this add all windows.
+     */
+    virtual void set_sketch(const WindowSketch *) {}
+
+    // Add only the windows in the specified shard
+    virtual void set_shard(const WindowShard &shard) = 0;
+
+    /*
+     * Return the number of distinct windows indexed.
+     * No more files can be indexed after this or the following
+     * method have been called.
+     */
+    virtual std::size_t size() = 0;
+
+    // Return the number of locations of windows seen more than once
+    virtual std::size_t number_of_clones() = 0;
+
+    /*
+     * Move the windows seen more than once into the specified map,
+     * with their locations in indexing order, and free the index.
+     */
+    virtual void move_clones(CloneDetector::candidates_type &candidates) = 0;
+
+    /*
+     * Drop the windows seen only once, and keep the rest for
+     * move_clone_batches; size() then returns their number.
+     * Return false if this is not supported, in which case the
+     * windows are obtained through move_clones.
+     */
+    virtual bool prune() { return false; }
+
+    typedef std::function<void(CloneDetector::candidates_type &)>
+        batch_callback_type;
+
+    /*
+     * Call fn(candidates) with successive batches of the windows seen
+     * more than once, in the order of their tokens, each batch moved
+     * into candidates as with move_clones, and free the index.
+     * Indices holding their windows out of memory bound the size of
+     * each batch.
+     */
+    virtual void move_clone_batches(const batch_callback_type &fn) {
+        CloneDetector::candidates_type candidates;
+        move_clones(candidates);
+        fn(candidates);
+    }
+};
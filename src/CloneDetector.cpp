@@ -17,120 +17,475 @@
  */
 
 #include <algorithm>
-#include <set>
+#include <atomic>
+#include <stdexcept>
+#include <string>
 
+#include "BlockIndex.h"
 #include "CloneDetector.h"
+#include "HashIndex.h"
+#include "Parallel.h"
+#include "ShardedIndex.h"
+#include "SortIndex.h"
+#include "SpillIndex.h"
+#include "SuffixIndex.h"
+#include "TokenCompare.h"
+#include "WindowHasher.h"
+#include "WindowSketch.h"
 
 // Construct from a container of all tokens encountered
-CloneDetector::CloneDetector(const TokenContainer &tc, unsigned clone_length)
-    : token_container(tc), clone_length(clone_length)
+CloneDetector::CloneDetector(const TokenContainer &tc, unsigned clone_length,
+        const DetectorOptions &options)
+    : token_container(tc), clone_length(clone_length),
+    // The suffix engine indexes all windows in its arrays
+    prefilter(options.prefilter && options.engine != IndexEngine::suffix),
+    nthreads(options.nthreads), partial_overlap(options.partial_overlap),
+    shard(options.shard), block_open(options.block_open),
+    block_close(options.block_close)
 {
     SeenTokens::set_token_container(&tc);
     SeenTokens::set_clone_length(clone_length);
 
+    if (options.block_regions)
+        block_index.reset(new BlockIndex(block_open, block_close));
+
+    if (options.memory_limit)
+        candidate_index.reset(new SpillIndex(tc, clone_length,
+                    options.nthreads, options.memory_limit));
+    else switch (options.engine) {
+    case IndexEngine::map:
+        break;
+    case IndexEngine::hash:
+        if (options.nthreads > 1)
+            candidate_index.reset(new ShardedIndex(tc, clone_length,
+                        options.nthreads));
+        else
+            candidate_index.reset(new HashIndex(tc, clone_length));
+        break;
+    case IndexEngine::sort:
+        candidate_index.reset(new SortIndex(tc, clone_length,
+                    options.nthreads));
+        break;
+    case IndexEngine::suffix:
+        candidate_index.reset(new SuffixIndex(tc, clone_length,
+                    options.nthreads));
+        break;
+    }
+    if (candidate_index)
+        candidate_index->set_shard(shard);
+
     for (const auto& file : tc.file_view())
-        for (const auto& line : file.line_view()) {
+        index_file(file);
+}
 
-            // Skip empty lines; nothing to add
-            if (file.line_is_empty(line))
-                continue;
+CloneDetector::~CloneDetector()
+{
+}
 
-            // Skip end sequences of insufficient length
-            if (file.remaining_tokens(line) < clone_length)
-                continue;
+// Add the token sequences starting at the file's lines as clone candidates
+void
+CloneDetector::index_file(const FileData &file)
+{
+    if (prefilter) {
+        prefilter_files.push_back(file.get_id());
+        return;
+    }
 
-            // Create an identifier for the token sequence to add
-            SeenTokens clone_candidates(file.get_id(), file.line_offset(line));
+    // Find the file's blocks while its tokens are in the cache
+    if (block_index)
+        block_index->index_file(file);
 
-            insert(clone_candidates, CloneLocation(file.get_id(), file.line_offset(line)));
-        }
+    if (candidate_index) {
+        candidate_index->index_file(file);
+        return;
+    }
+
+    if (sketch || !shard.is_whole()) {
+        WindowHasher hasher(clone_length);
+        hasher.set_sketch(sketch.get());
+        hasher.set_shard(shard);
+        hasher.for_each_window(file, [&](FileData::token_offset_type offset,
+                    WindowHasher::fingerprint_type) {
+            CloneLocation location(file.get_id(), offset);
+            insert(SeenTokens(file.get_id(), offset), location);
+        });
+        return;
+    }
+
+    for (const auto& line : file.line_view()) {
+
+        // Skip empty lines; nothing to add
+        if (file.line_is_empty(line))
+            continue;
+
+        // Skip end sequences of insufficient length
+        if (file.remaining_tokens(line) < clone_length)
+            continue;
+
+        // Create an identifier for the token sequence to add
+        SeenTokens clone_candidates(file.get_id(), file.line_offset(line));
+
+        insert(clone_candidates, CloneLocation(file.get_id(), file.line_offset(line)));
+    }
+}
+
+/*
+ * Add the windows of the recorded files to a sketch, and then index
+ * only those that the sketch reports as seen at least twice.
+ * This avoids indexing most unique windows.
+ */
+void
+CloneDetector::apply_prefilter()
+{
+    if (!prefilter)
+        return;
+    prefilter = false;
+
+    std::size_t nlines = 0;
+    for (auto id : prefilter_files)
+        nlines += token_container.get_file(id).line_size();
+    sketch.reset(new WindowSketch(nlines / shard.count));
+
+    std::atomic<std::size_t> nwindows(0);
+    parallel_for(nthreads, prefilter_files.size(), [&](std::size_t i) {
+        WindowHasher hasher(clone_length);
+        hasher.set_shard(shard);
+        std::size_t n = 0;
+        hasher.for_each_window(token_container.get_file(prefilter_files[i]),
+                [&](FileData::token_offset_type,
+                    WindowHasher::fingerprint_type fingerprint) {
+            sketch->add(fingerprint);
+            n++;
+        });
+        nwindows += n;
+    });
+    prefilter_windows = nwindows;
+
+    if (candidate_index)
+        candidate_index->set_sketch(sketch.get());
+    for (auto id : prefilter_files)
+        index_file(token_container.get_file(id));
+    std::vector<TokenContainer::file_id_type>().swap(prefilter_files);
+}
+
+// Return the number of sites for potential clones
+int
+CloneDetector::get_number_of_seen_sites()
+{
+    apply_prefilter();
+    if (candidate_index)
+        return candidate_index->size();
+    return clone_candidates.size();
+}
+
+// Return the number of potential clones found
+int
+CloneDetector::get_number_of_seen_clones()
+{
+    apply_prefilter();
+    if (candidate_index)
+        return candidate_index->number_of_clones();
+
+    int nclones = 0;
+    for (const auto& it : clone_candidates) {
+        size_t nelem = it.second.size();
+        if (nelem > 1)
+            nclones += nelem;
+    }
+    return nclones;
 }
 
 // Prune-away recorded tokens not associated with clones
 void
 CloneDetector::prune_non_clones() {
-    for (auto it = clone_candidates.begin(); it != clone_candidates.end();)
-        if (it->second.size() == 1)
-            it = clone_candidates.erase(it);
-        else
-            ++it;
+    apply_prefilter();
+
+    std::size_t nsites = 0, nclones = 0;
+    if (sketch) {
+        nsites = get_number_of_seen_sites();
+        nclones = get_number_of_seen_clones();
+    }
+
+    if (candidate_index) {
+        // Otherwise the index supplies its clones during their creation
+        if (!candidate_index->prune()) {
+            candidate_index->move_clones(clone_candidates);
+            candidate_index.reset();
+        }
+    } else
+        for (auto it = clone_candidates.begin(); it != clone_candidates.end();)
+            if (it->second.size() == 1)
+                it = clone_candidates.erase(it);
+            else
+                ++it;
+
+    if (sketch) {
+        // Sites that turned out to be unique were false positives
+        prefilter_false_positives = nsites - get_number_of_seen_sites();
+        prefilter_unique_windows = prefilter_windows - nclones;
+        sketch.reset();
+    }
+}
+
+// Clear the clone_candidates data structure
+void
+CloneDetector::clear_clone_candidates()
+{
+    // Release the pool holding the map's nodes
+    clone_candidates = candidates_type();
+    candidate_index.reset();
 }
 
 // Report found clones in text format
 void
-CloneDetector::report_text() const {
+CloneDetector::report_text(OutputWriter &out) const {
     for (const auto& clone_group : clones) {
-        std::cout << clone_group.size() << "\t";
-        std::cout << clone_group.front().size() << std::endl;
+        out << clone_group.size() << '\t' << clone_group.front().size() << '\n';
         for (const auto& member : clone_group) {
             auto member_file_id = member.get_file_id();
-            std::cout << token_container.get_token_line_number(member_file_id, member.get_begin_token_offset()) + 1 << '\t';
-            std::cout << token_container.get_token_line_number(member_file_id, member.get_end_token_offset() - 1) + 1 << '\t';
-            std::cout << token_container.get_file_name(member_file_id) << std::endl;
-        }
-        std::cout << std::endl;
-    }
-}
-
-// Escape characters to make a string valid JSON string
-std::string
-escape_json_string(const std::string& input) {
-    std::string result;
-
-    for (char c : input) {
-        switch (c) {
-        case '"':
-            result += "\\\"";
-            break;
-        case '\\':
-            result += "\\\\";
-            break;
-        default:
-            result += c;
+            out << token_container.get_token_line_number(member_file_id, member.get_begin_token_offset()) + 1 << '\t';
+            out << token_container.get_token_line_number(member_file_id, member.get_end_token_offset() - 1) + 1 << '\t';
+            out << token_container.get_file_name(member_file_id) << '\n';
         }
+        out << '\n';
     }
-    return result;
 }
 
 // Report found clones in JSON format
 void
-CloneDetector::report_json() const {
-    std::cout << "[" << std::endl;
+CloneDetector::report_json(OutputWriter &out) const {
+    out << "[\n";
     // For each clone group
-    for (auto cg_it = clones.begin(); cg_it != clones.end(); ++cg_it) {
-        std::cout << "  {" << std::endl;
-        std::cout << "    \"tokens\": "
-            << cg_it->front().size() << ',' << std::endl;
-        std::cout << "    \"groups\": [" << std::endl;
+    for (std::size_t g = 0; g < clones.size(); g++) {
+        auto clone_group = clones[g];
+        out << "  {\n";
+        out << "    \"tokens\": " << clone_group.front().size() << ",\n";
+        out << "    \"groups\": [\n";
 
         // For each member of the clone group
-        for (auto member_it = cg_it->begin(); member_it != cg_it->end(); ++member_it) {
-            std::cout << "      {" << std::endl;
-            std::cout << "        \"start\": "
+        for (auto member_it = clone_group.begin(); member_it != clone_group.end(); ++member_it) {
+            out << "      {\n";
+            out << "        \"start\": "
                 << token_container.get_token_line_number(member_it->get_file_id(), member_it->get_begin_token_offset()) + 1
-                << ',' << std::endl;
+                << ",\n";
 
-            std::cout << "        \"end\": "
+            out << "        \"end\": "
                 << token_container.get_token_line_number(member_it->get_file_id(), member_it->get_end_token_offset()) + 1
-                << ',' << std::endl;
+                << ",\n";
 
-            std::cout << "        \"filepath\": \""
-                << escape_json_string(
-                        token_container.get_file_name(member_it->get_file_id()))
-                << '"' << std::endl;
+            out << "        \"filepath\": \"";
+            out.write_json_string(
+                    token_container.get_file_name(member_it->get_file_id()));
+            out << "\"\n";
 
-            if (std::next(member_it) == cg_it->end())
-                std::cout << "      }" << std::endl;
+            if (std::next(member_it) == clone_group.end())
+                out << "      }\n";
             else
-                std::cout << "      }," << std::endl;
+                out << "      },\n";
         }
-        std::cout << "    ]" << std::endl;
-        if (std::next(cg_it) == clones.end())
-            std::cout << "  }" << std::endl;
+        out << "    ]\n";
+        if (g + 1 == clones.size())
+            out << "  }\n";
         else
-            std::cout << "  }," << std::endl;
+            out << "  },\n";
+    }
+    out << "]\n";
+}
+
+/*
+ * Report found clones in newline-delimited JSON format.
+ * Each group is written as an object on a separate line, containing
+ * its clones as [file id, start line, end line] arrays.
+ * Each file is identified by an object on a separate line, which
+ * precedes the first group referring to it.
+ */
+void
+CloneDetector::report_ndjson(OutputWriter &out) const {
+    std::vector<bool> file_reported(token_container.file_size());
+    for (std::size_t g = 0; g < clones.size(); g++) {
+        auto clone_group = clones[g];
+        for (const auto& member : clone_group) {
+            auto file_id = member.get_file_id();
+            if (file_reported[file_id])
+                continue;
+            file_reported[file_id] = true;
+            out << "{\"file\":" << file_id << ",\"path\":\"";
+            out.write_json_string(token_container.get_file_name(file_id));
+            out << "\"}\n";
+        }
+
+        out << "{\"group\":" << g
+            << ",\"tokens\":" << clone_group.front().size()
+            << ",\"clones\":[";
+        for (auto member_it = clone_group.begin(); member_it != clone_group.end(); ++member_it) {
+            auto file_id = member_it->get_file_id();
+            if (member_it != clone_group.begin())
+                out << ',';
+            out << '[' << file_id << ','
+                << token_container.get_token_line_number(file_id, member_it->get_begin_token_offset()) + 1 << ','
+                << token_container.get_token_line_number(file_id, member_it->get_end_token_offset() - 1) + 1 << ']';
+        }
+        out << "]}\n";
+    }
+}
+
+/*
+ * The binary output format consists of
+ * - A header containing the bytes of REPORT_MAGIC.
+ * - A sequence of records, each starting with an unsigned LEB128 varint
+ *   whose least significant bit identifies the record's type.
+ *   - File records have the bit set.  The remaining bits hold the
+ *     file's id, followed by a varint with the length of the file's
+ *     name, whose bytes follow.  A file record precedes the first
+ *     group record referring to the file.
+ *   - Group records have the bit clear.  The remaining bits hold the
+ *     number of the group's clones, followed by a varint with the
+ *     number of each clone's tokens, and, for each clone,
+ *     varints with its file id, start line, and end line.
+ */
+static const char REPORT_MAGIC[] = {'M', 'P', 'C', 'D', 'C', 'L', 'N', '\1'};
+
+// Write the file's binary record, unless already reported
+void
+CloneDetector::report_binary_file(OutputWriter &out,
+        std::vector<bool> &file_reported,
+        TokenContainer::file_id_type file_id) const {
+    if (file_reported[file_id])
+        return;
+    file_reported[file_id] = true;
+    const std::string &name = token_container.get_file_name(file_id);
+    out.write_varint(std::uint64_t(file_id) << 1 | 1);
+    out.write_varint(name.size());
+    out << name;
+}
+
+// Report found clones in binary format
+void
+CloneDetector::report_binary(OutputWriter &out) const {
+    std::vector<bool> file_reported(token_container.file_size());
+    out.write_bytes(REPORT_MAGIC, sizeof(REPORT_MAGIC));
+    for (const auto& clone_group : clones) {
+        for (const auto& member : clone_group)
+            report_binary_file(out, file_reported, member.get_file_id());
+
+        out.write_varint(std::uint64_t(clone_group.size()) << 1);
+        out.write_varint(clone_group.front().size());
+        for (const auto& member : clone_group) {
+            auto file_id = member.get_file_id();
+            out.write_varint(file_id);
+            out.write_varint(token_container.get_token_line_number(file_id, member.get_begin_token_offset()) + 1);
+            out.write_varint(token_container.get_token_line_number(file_id, member.get_end_token_offset() - 1) + 1);
+        }
+    }
+}
+
+/*
+ * Call f(first, second) for the pairs of the group's clones:
+ * the first clone with each other one, or all pairs, up to the
+ * specified maximum number of pairs.
+ */
+template <typename Group, typename F>
+static void
+for_each_pair(const Group &clone_group, const ReportOptions &options, F f)
+{
+    std::size_t npairs = 0;
+    for (auto first = clone_group.begin(); first != clone_group.end(); ++first) {
+        for (auto second = first + 1; second != clone_group.end(); ++second) {
+            if (options.max_pairs && npairs++ == options.max_pairs)
+                return;
+            f(*first, *second);
+        }
+        if (!options.all_pairs)
+            return;
+    }
+}
+
+/*
+ * Report pairs of clones as comma-separated lines with the
+ * directory, file name, start line, and end line of each clone,
+ * as required by BigCloneEval.
+ * The directory is the last component of the file's path.
+ */
+void
+CloneDetector::report_pairs(OutputWriter &out,
+        const ReportOptions &options) const
+{
+    auto report_clone = [this, &out](const Clone &clone) {
+        auto file_id = clone.get_file_id();
+        const std::string &path = token_container.get_file_name(file_id);
+        auto dir_end = path.rfind('/');
+        if (dir_end == std::string::npos)
+            out << ',' << path;
+        else {
+            // A missing separator (npos) yields 0
+            auto dir_begin = dir_end == 0 ? 0 : path.rfind('/', dir_end - 1) + 1;
+            out.write_bytes(path.data() + dir_begin, dir_end - dir_begin);
+            out << ',';
+            out.write_bytes(path.data() + dir_end + 1, path.size() - dir_end - 1);
+        }
+        out << ',' << token_container.get_token_line_number(file_id, clone.get_begin_token_offset()) + 1
+            << ',' << token_container.get_token_line_number(file_id, clone.get_end_token_offset() - 1) + 1;
+    };
+
+    for (const auto& clone_group : clones)
+        for_each_pair(clone_group, options,
+                [&out, &report_clone](const Clone &first, const Clone &second) {
+            report_clone(first);
+            out << ',';
+            report_clone(second);
+            out << '\n';
+        });
+}
+
+/*
+ * The binary pairs output format has the same structure as the
+ * binary output format, but starts with PAIRS_MAGIC, and
+ * has its group records replaced by pair records.
+ * Pair records have the least significant bit clear.
+ * The remaining bits hold the number of the pair's group, followed
+ * by a varint with the number of each clone's tokens, and,
+ * for each of the two clones,
+ * varints with its file id, start line, and end line.
+ */
+static const char PAIRS_MAGIC[] = {'M', 'P', 'C', 'D', 'P', 'A', 'R', '\1'};
+
+// Report pairs of clones in binary format
+void
+CloneDetector::report_binary_pairs(OutputWriter &out,
+        const ReportOptions &options) const
+{
+    std::vector<bool> file_reported(token_container.file_size());
+    out.write_bytes(PAIRS_MAGIC, sizeof(PAIRS_MAGIC));
+    auto report_clone = [this, &out](const Clone &clone) {
+        auto file_id = clone.get_file_id();
+        out.write_varint(file_id);
+        out.write_varint(token_container.get_token_line_number(file_id, clone.get_begin_token_offset()) + 1);
+        out.write_varint(token_container.get_token_line_number(file_id, clone.get_end_token_offset() - 1) + 1);
+    };
+
+    for (std::size_t g = 0; g < clones.size(); g++)
+        for_each_pair(clones[g], options,
+                [&](const Clone &first, const Clone &second) {
+            report_binary_file(out, file_reported, first.get_file_id());
+            report_binary_file(out, file_reported, second.get_file_id());
+            out.write_varint(std::uint64_t(g) << 1);
+            out.write_varint(first.size());
+            report_clone(first);
+            report_clone(second);
+        });
+}
+
+// Report found clones as specified by the options
+void
+CloneDetector::report(OutputWriter &out, const ReportOptions &options) const {
+    switch (options.format) {
+    case ReportFormat::text: report_text(out); break;
+    case ReportFormat::json: report_json(out); break;
+    case ReportFormat::ndjson: report_ndjson(out); break;
+    case ReportFormat::binary: report_binary(out); break;
+    case ReportFormat::pairs: report_pairs(out, options); break;
+    case ReportFormat::binary_pairs: report_binary_pairs(out, options); break;
     }
-    std::cout << "]" << std::endl;
 }
 
 // Container holding the encountered tokens
@@ -139,16 +494,111 @@ const TokenContainer* SeenTokens::token_container;
 // Length of identified token sequences
 unsigned SeenTokens::clone_length;
 
+// Comparison of windows of that length
+WindowCompare SeenTokens::window_compare;
+
 // Return true if the tokens identified on the lhs < than the rhs ones
 bool
 operator<(const SeenTokens& lhs, const SeenTokens& rhs) {
-    const TokenContainer* tc = SeenTokens::get_token_container();
-    unsigned clone_length  = SeenTokens::get_clone_length();
+    if (lhs.prefix != rhs.prefix)
+        return lhs.prefix < rhs.prefix;
+    return SeenTokens::window_compare.compare(lhs.tokens(), rhs.tokens()) < 0;
+}
 
-    auto lhs_it = tc->offset_begin(lhs.get_file_id(), lhs.get_begin_token_offset());
-    auto rhs_it = tc->offset_begin(rhs.get_file_id(), rhs.get_begin_token_offset());
-    return std::lexicographical_compare(lhs_it, lhs_it + clone_length,
-            rhs_it, rhs_it + clone_length);
+/*
+ * Call create(leader, members, groups) for all clone candidates
+ * using multiple threads, and append the created groups
+ * to "clones" in the order of the candidates.
+ * The candidates are split into many more tasks than threads,
+ * so that threads finishing early take over the remaining tasks
+ * when some groups are much larger than others.
+ * Each task creates its groups in a separate list, and the lists are
+ * then spliced in task order, yielding the order of a serial run.
+ */
+template <typename F>
+void
+CloneDetector::create_clone_groups(F create)
+{
+    if (candidate_index) {
+        // Candidates held out of memory arrive in batches
+        candidate_index->move_clone_batches([&](candidates_type &batch) {
+            create_clone_groups(batch, create);
+        });
+        candidate_index.reset();
+    } else
+        create_clone_groups(clone_candidates, create);
+}
+
+// Create the clone groups of the specified candidates
+template <typename F>
+void
+CloneDetector::create_clone_groups(const candidates_type &candidate_map,
+        F create)
+{
+    std::vector<const candidates_type::value_type *> candidates;
+    candidates.reserve(candidate_map.size());
+    for (const auto& it : candidate_map)
+        candidates.push_back(&it);
+
+    const std::size_t ntasks = nthreads > 1
+        ? std::min<std::size_t>(candidates.size(), 64 * nthreads)
+        : std::min<std::size_t>(candidates.size(), 1);
+    std::vector<clone_groups_type> task_clones(ntasks);
+    std::vector<std::vector<CloneLocation>> task_leaders(ntasks);
+    parallel_for(nthreads, ntasks, [&](std::size_t task) {
+        std::size_t end = candidates.size() * (task + 1) / ntasks;
+        for (std::size_t i = candidates.size() * task / ntasks; i < end; i++) {
+            create(candidates[i]->first, candidates[i]->second,
+                    task_clones[task]);
+            // Merging shards orders the groups by their leader
+            if (!shard.is_whole())
+                task_leaders[task].resize(task_clones[task].size(),
+                        candidates[i]->first);
+        }
+    });
+
+    for (std::size_t task = 0; task < ntasks; task++) {
+        clones.append(task_clones[task]);
+        group_leaders.insert(group_leaders.end(),
+                task_leaders[task].begin(), task_leaders[task].end());
+    }
+}
+
+/*
+ * Convert partial candidate clones associated with a leader and
+ * its members into full clones in "groups", based on clone lines.
+ */
+void
+CloneDetector::create_line_region_clone(const SeenTokens& leader,
+        const seen_locations_type& members, clone_groups_type& groups) const
+{
+    // Extent of clone leader data to line end
+    auto leader_file_id = leader.get_file_id();
+    auto leader_extension_begin = token_container.offset_begin(leader_file_id, leader.get_begin_token_offset() + clone_length);
+    auto leader_line_end = token_container.line_from_offset_end(leader_file_id, leader.get_begin_token_offset() + clone_length - 1);
+    auto leader_extension_length = leader_line_end - leader_extension_begin;
+    // Create a group of clones that are the same till the end of the line
+    for (const auto& member : members) {
+        auto member_file_id = member.get_file_id();
+        auto member_extension_begin = token_container.offset_begin(member_file_id, member.get_begin_token_offset() + clone_length);
+        auto offset_in_last_line = member.get_begin_token_offset() + clone_length - 1;
+        auto member_line_end = token_container.line_from_offset_end(member_file_id, offset_in_last_line);
+
+        // Unequal line length extensions
+        if (member_line_end - member_extension_begin != leader_extension_length)
+            continue;
+        // Unequal extension contents
+        if (!tokens_equal(leader_extension_begin, member_extension_begin,
+                    leader_extension_length))
+            continue;
+        auto member_end_offset = member.get_begin_token_offset() + clone_length + leader_extension_length;
+        groups.push_back(Clone(member_file_id,
+                    member.get_begin_token_offset(), member_end_offset));
+    }
+    if (groups.open_size() > 1)
+        groups.end_group();
+    else
+        groups.discard_group();
 }
 
 /*
@@ -158,40 +608,15 @@ operator<(const SeenTokens& lhs, const SeenTokens& rhs) {
 void
 CloneDetector::create_line_region_clones()
 {
-    for (const auto& it : clone_candidates) {
-        auto leader = it.first;
-
-        // Extent of clone leader data to line end
-        auto leader_file_id = leader.get_file_id();
-        auto leader_extension_begin = token_container.offset_begin(leader_file_id, leader.get_begin_token_offset() + clone_length);
-        auto leader_line_end = token_container.line_from_offset_end(leader_file_id, leader.get_begin_token_offset() + clone_length - 1);
-        auto leader_extension_length = leader_line_end - leader_extension_begin;
-        // Create a group of clones that are the same till the end of the line
-        std::list<Clone> group;
-        for (const auto& member : it.second) {
-            auto member_file_id = member.get_file_id();
-            auto member_extension_begin = token_container.offset_begin(member_file_id, member.get_begin_token_offset() + clone_length);
-            auto offset_in_last_line = member.get_begin_token_offset() + clone_length - 1;
-            auto member_line_end = token_container.line_from_offset_end(member_file_id, offset_in_last_line);
-
-            // Unequal line length extensions
-            if (member_line_end - member_extension_begin != leader_extension_length)
-                continue;
-            // Unequal extension contents
-            if (!std::equal(leader_extension_begin, leader_line_end, member_extension_begin))
-                continue;
-            auto member_end_offset = member.get_begin_token_offset() + clone_length + leader_extension_length;
-            group.emplace_back(Clone(member_file_id,
-                        member.get_begin_token_offset(), member_end_offset));
-        }
-        if (group.size() > 1)
-            clones.push_back(std::move(group));
-    }
+    create_clone_groups([this](const SeenTokens& leader,
+                const seen_locations_type& members, clone_groups_type& groups) {
+        create_line_region_clone(leader, members, groups);
+    });
 }
 
 /*
  * Convert partial candidate clones associated with a leader and
- * its members into full clones in "clone", based on clone blocks.
+ * its members into full clones in "groups", based on clone blocks.
  * Attempt to start the clone "offset" tokens back from the recorded
  * start to cater for clone blocks starting on an (otherwise differing)
  * previous line.
@@ -199,7 +624,8 @@ CloneDetector::create_line_region_clones()
  */
 bool
 CloneDetector::create_block_region_clone(const SeenTokens& leader,
-        const seen_locations_type& members, int offset)
+        const seen_locations_type& members, int offset,
+        clone_groups_type& groups) const
 {
     auto leader_begin_token_offset = leader.get_begin_token_offset();
     if (leader_begin_token_offset == 0 && offset < 0)
@@ -214,34 +640,25 @@ CloneDetector::create_block_region_clone(const SeenTokens& leader,
     auto leader_search_end = std::min(leader_end, leader_line_end);
     auto leader_block_begin = leader_begin + offset;
     for (; leader_block_begin < leader_search_end; ++leader_block_begin)
-        if (*leader_block_begin == '{')
+        if (*leader_block_begin == block_open)
             break;
     if (leader_block_begin == leader_search_end)
         return false;  // This candidate does not contain a code block; skip it
 
     // Find matching end
-    int block_depth = 0;
-    auto leader_block_end = leader_block_begin;
-    auto leader_file_end = token_container.file_end(leader_file_id);
-    for (; leader_block_end < leader_file_end; ++leader_block_end) {
-        switch (*leader_block_end) {
-        case '{': ++block_depth; break;
-        case '}': --block_depth; break;
-        }
-        if (block_depth == 0)
-            break;
-    }
-
-    if (leader_block_end == leader_file_end)
+    std::size_t block_end = block_index->block_end(leader_file_id,
+            leader_begin_token_offset + (leader_block_begin - leader_begin));
+    if (block_end == BlockIndex::NO_BLOCK_END)
         return false;  // No block end found
 
-    ++leader_block_end;  // Point past closing brace to include it
+    // Point past closing brace to include it
+    auto leader_block_end = leader_begin
+        + (block_end + 1 - leader_begin_token_offset);
 
     if (leader_block_end - leader_block_begin < clone_length)
         return false;  // Block smaller than the specified cline length
 
     // Create a group of clones that are the same till the end of the block
-    std::list<Clone> group;
     auto block_extension_length = leader_block_end - leader_end;
     auto leader_extension_begin = leader_begin + clone_length;
     for (const auto& member : members) {
@@ -250,11 +667,12 @@ CloneDetector::create_block_region_clone(const SeenTokens& leader,
 
         // Check for unequal contents at the offset position
         if (offset) {
-            if (member_begin_token_offset + offset < 0)
+            if (offset < 0 && member_begin_token_offset < unsigned(-offset))
                 continue;  // Can't deal with this offset
 
             auto member_begin = token_container.offset_begin(member_file_id, member_begin_token_offset);
-            if (!std::equal(leader_begin + offset, leader_begin, member_begin + offset))
+            if (!tokens_equal(leader_begin + offset, member_begin + offset,
+                        -offset))
                 continue;
         }
 
@@ -266,18 +684,20 @@ CloneDetector::create_block_region_clone(const SeenTokens& leader,
 
         // Check for unequal extension contents
         if (leader_block_end > leader_extension_begin
-            && !std::equal(leader_extension_begin, leader_block_end, member_extension_begin))
+            && !tokens_equal(leader_extension_begin, member_extension_begin,
+                leader_block_end - leader_extension_begin))
             continue;
 
         auto member_end_offset = member.get_begin_token_offset() + clone_length + block_extension_length;
-        group.emplace_back(Clone(member_file_id,
+        groups.push_back(Clone(member_file_id,
                     member.get_begin_token_offset(), member_end_offset));
     }
 
-    if (group.size() > 1) {
-        clones.push_back(std::move(group));
+    if (groups.open_size() > 1) {
+        groups.end_group();
         return true;
     }
+    groups.discard_group();
     return false;
 }
 
@@ -288,87 +708,242 @@ CloneDetector::create_block_region_clone(const SeenTokens& leader,
 void
 CloneDetector::create_block_region_clones()
 {
-    for (const auto& it : clone_candidates)
+    if (!block_index)
+        block_index.reset(new BlockIndex(token_container, block_open,
+                    block_close, nthreads));
+    create_clone_groups([this](const SeenTokens& leader,
+                const seen_locations_type& members, clone_groups_type& groups) {
         // First try the previous token for blocks starting on an otherwise
         // different previous line
         for (int offset = -1; offset <= 0; ++offset)
-            if (create_block_region_clone(it.first, it.second, offset))
+            if (create_block_region_clone(leader, members, offset, groups))
                 break;
+    });
+    block_index.reset();
+}
+
+/*
+ * Extend the group's clones to subsequent lines as much as possible.
+ * The extension is the shortest of the members' common prefix with
+ * the tokens following the leader, within the members' files.
+ */
+void
+CloneDetector::extend_clone_group(clone_groups_type::range clone_group) const
+{
+    const auto& leader(clone_group.front());
+    const FileData& leader_file(token_container.get_file(leader.get_file_id()));
+    auto leader_end = leader.get_end_token_offset();
+    auto leader_extension_begin = leader_file.offset_begin(leader_end);
+    std::size_t extension = leader_file.token_size() - leader_end;
+
+    auto member = clone_group.begin();
+    for (++member; member != clone_group.end() && extension > 0; ++member) {
+        const FileData& file(token_container.get_file(member->get_file_id()));
+        auto end = member->get_end_token_offset();
+        extension = token_mismatch(leader_extension_begin,
+                file.offset_begin(end),
+                std::min<std::size_t>(extension, file.token_size() - end));
+    }
+
+    // Extend all members and trim them to preceding end of line
+    for (auto& member : clone_group) {
+        member.set_end_token_offset(member.get_end_token_offset() + extension);
+        trim_to_eol(member);
+    }
 }
 
 // Extend clones to subsequent lines as much as possible
 void
 CloneDetector::extend_clones()
 {
-    for (auto& clone_group : clones) {
-        // Extend group members as much as possible
-        for (;;) {
-            auto& leader(clone_group.front());
-            auto leader_end_token = get_end_token(leader);
-            auto member = clone_group.begin();
-            for (++member; member != clone_group.end(); ++member)
-                if (get_end_token(*member) != leader_end_token)
-                    break;
-            if (member != clone_group.end())
-                break;  // Difference found; stop advancing
-            // Extend all group's members by one token
-            for (auto& member : clone_group)
-                member.extend_by_one();
-        }
-        // Trim all members to preceding end of line
-        for (auto& member : clone_group)
-            trim_to_eol(member);
-    }
+    parallel_for(nthreads, clones.size(), [&](std::size_t i) {
+        extend_clone_group(clones[i]);
+    });
 }
 
 /*
  * Remove clone groups whose members are entirely shadowed by others.
  *
- * 1. Create a set ordered by and clone location.
- * 2. Traverse the set, marking elements completely shadowed by their
- *    predecessor in the same file as shadowed.
+ * 1. Distribute the extents of all clones into one array per file,
+ *    through a counting sort on the file id.
+ * 2. For each file in parallel, sort its extents by their begin offset
+ *    and then by their descending end offset, and sweep over them
+ *    marking as shadowed those ending before the furthest end seen
+ *    so far, or, with partial overlap shadowing, beginning before it.
+ *    The sort is stable, so that of clones with identical extents
+ *    the one of the earliest group is kept, regardless of the library's
+ *    sort implementation or the files processed together.
  * 3. Traverse the clone groups removing those that have all their elements
  *    shadowed.
  */
 void
 CloneDetector::remove_shadowed_groups()
 {
-    struct Compare {
-        bool operator() (const Clone* lhs, const Clone* rhs) const {
-            return *lhs < *rhs;
-        }
+    struct Extent {
+        Clone::token_offset_type begin, end;
+        Clone *clone;
     };
 
-    std::set<Clone*, Compare> ordered_clones;
+    std::vector<std::size_t> file_begin(token_container.file_size() + 1);
+    for (auto clone_group : clones)
+        for (const auto& clone : clone_group)
+            file_begin[clone.get_file_id() + 1]++;
+    for (std::size_t i = 1; i < file_begin.size(); i++)
+        file_begin[i] += file_begin[i - 1];
 
-    // Create a set ordered by and clone location.
-    for (auto& clone_group : clones)
+    std::vector<Extent> extents(clones.element_size());
+    std::vector<std::size_t> position(file_begin.begin(), file_begin.end() - 1);
+    for (auto clone_group : clones)
         for (auto& clone : clone_group)
-            ordered_clones.insert(&clone);
-
-    // Mark clones
-    Clone* shadow = nullptr;
-    for (auto& clone : ordered_clones) {
-        // Clear shadow when crossing file boundary
-        if (shadow && shadow->get_file_id() != clone->get_file_id())
-            shadow = nullptr;
-
-        if (shadow && clone->is_shadowed(*shadow))
-            clone->set_shadowed();
-        shadow = clone;
-    }
+            extents[position[clone.get_file_id()]++] = Extent{
+                Clone::token_offset_type(clone.get_begin_token_offset()),
+                Clone::token_offset_type(clone.get_end_token_offset()),
+                &clone};
+
+    parallel_for(nthreads, token_container.file_size(), [&](std::size_t f) {
+        auto begin = extents.begin() + file_begin[f];
+        auto end = extents.begin() + file_begin[f + 1];
+        std::stable_sort(begin, end, [](const Extent& a, const Extent& b) {
+            return a.begin < b.begin || (a.begin == b.begin && a.end > b.end);
+        });
+
+        // Furthest end of the preceding clones
+        Clone::token_offset_type shadow_end = 0;
+        for (auto it = begin; it != end; ++it) {
+            if (it != begin && (it->end <= shadow_end
+                        || (partial_overlap && it->begin < shadow_end)))
+                it->clone->set_shadowed();
+            shadow_end = std::max(shadow_end, it->end);
+        }
+    });
 
     // Remove entirely shadowed clone groups
-    for (auto group_it = clones.begin(); group_it != clones.end(); ) {
-        auto clone_it = group_it->begin();
-        for (; clone_it != group_it->end(); ++clone_it)
-            if (!clone_it->is_shadowed())
-                break;
+    clones.remove_if([](clone_groups_type::const_range clone_group) {
+        for (const auto& clone : clone_group)
+            if (!clone.is_shadowed())
+                return false;
+        return true;
+    });
+}
 
-        // See if entirely shadowed and erase
-        if (clone_it == group_it->end())
-            group_it = clones.erase(group_it);
-        else
-            ++group_it;
+// Identification and version of the shard format
+static const char shard_magic[] = "MPCD-SHARD";
+static const int shard_version = 1;
+
+/*
+ * Write the clone groups of a shard, before their shadowing is
+ * checked, in a form that can be merged with those of other shards.
+ * A header line identifies the shard and the input it was created
+ * from.  Each group follows as a line with the number of its clones
+ * and the location of the window from which it was created,
+ * followed by a line with the file id and token extent of each clone.
+ */
+void
+CloneDetector::write_shard(std::ostream &out) const
+{
+    out << shard_magic << '\t' << shard_version << '\t'
+        << shard.index << '\t' << shard.count << '\t'
+        << clone_length << '\t'
+        << token_container.file_size() << '\t'
+        << token_container.token_size() << '\n';
+
+    for (std::size_t g = 0; g < clones.size(); g++) {
+        auto clone_group = clones[g];
+        const CloneLocation &leader = group_leaders[g];
+        out << clone_group.size() << '\t' << leader.get_file_id() << '\t'
+            << leader.get_begin_token_offset() << '\n';
+        for (const auto& clone : clone_group)
+            out << clone.get_file_id() << '\t'
+                << clone.get_begin_token_offset() << '\t'
+                << clone.get_end_token_offset() << '\n';
+    }
+}
+
+// Add the clone groups of a shard written by write_shard
+void
+CloneDetector::read_shard(std::istream &in)
+{
+    std::string magic;
+    int version;
+    unsigned index, count, length;
+    std::size_t nfiles, ntokens;
+    if (!(in >> magic >> version) || magic != shard_magic
+            || version != shard_version)
+        throw std::runtime_error("Not an mpcd shard");
+    if (!(in >> index >> count >> length >> nfiles >> ntokens)
+            || count == 0 || index >= count)
+        throw std::runtime_error("Invalid shard header");
+    if (length != clone_length)
+        throw std::runtime_error("Shard created with a different clone length");
+    if (nfiles != token_container.file_size()
+            || ntokens != token_container.token_size())
+        throw std::runtime_error("Shard created from different input");
+
+    if (read_shards.empty())
+        read_shards.resize(count);
+    else if (read_shards.size() != count)
+        throw std::runtime_error("Shard from a different number of shards");
+    if (read_shards[index])
+        throw std::runtime_error("Shard " + std::to_string(index)
+                + " specified more than once");
+    read_shards[index] = true;
+
+    // Return true if the specified token range lies within the file
+    auto valid = [this](std::size_t file_id, std::size_t begin,
+            std::size_t end) {
+        return file_id < token_container.file_size()
+            && begin < end
+            && end <= token_container.get_file(file_id).token_size();
+    };
+
+    std::size_t nclones, file_id, begin, end;
+    while (in >> nclones) {
+        if (nclones < 2 || !(in >> file_id >> begin)
+                || !valid(file_id, begin, begin + clone_length))
+            throw std::runtime_error("Invalid shard clone group");
+        group_leaders.push_back(CloneLocation(file_id, begin));
+        for (std::size_t i = 0; i < nclones; i++) {
+            if (!(in >> file_id >> begin >> end) || !valid(file_id, begin, end))
+                throw std::runtime_error("Invalid shard clone");
+            clones.push_back(Clone(file_id, begin, end));
+        }
+        clones.end_group();
+    }
+    if (!in.eof())
+        throw std::runtime_error("Invalid shard clone group");
+}
+
+/*
+ * Order the groups read from all shards as those of a single process.
+ * Each shard's groups are ordered by the windows from which they were
+ * created, and each window belongs to a single shard, so a stable sort
+ * of all groups by their windows' tokens yields the single process order.
+ */
+void
+CloneDetector::merge_shards()
+{
+    for (std::size_t i = 0; i < read_shards.size(); i++)
+        if (!read_shards[i])
+            throw std::runtime_error("Shard " + std::to_string(i)
+                    + " of " + std::to_string(read_shards.size())
+                    + " is missing");
+
+    std::vector<std::size_t> order(clones.size());
+    for (std::size_t g = 0; g < order.size(); g++)
+        order[g] = g;
+    std::stable_sort(order.begin(), order.end(),
+            [this](std::size_t a, std::size_t b) {
+        const CloneLocation &la = group_leaders[a], &lb = group_leaders[b];
+        return SeenTokens(la.get_file_id(), la.get_begin_token_offset())
+            < SeenTokens(lb.get_file_id(), lb.get_begin_token_offset());
+    });
+
+    clone_groups_type merged;
+    for (auto g : order) {
+        for (const auto& clone : clones[g])
+            merged.push_back(clone);
+        merged.end_group();
     }
+    clones = std::move(merged);
+    std::vector<CloneLocation>().swap(group_leaders);
 }
@@ -18,12 +18,20 @@
 
 #pragma once
 
-#include <list>
+#include <cstdint>
+#include <istream>
 #include <map>
+#include <memory>
 #include <vector>
 #include <ostream>
 
+#include "GroupedVector.h"
+#include "OutputWriter.h"
+#include "PoolAllocator.h"
+#include "SmallVector.h"
+#include "TokenCompare.h"
 #include "TokenContainer.h"
+#include "WindowHasher.h"
 
 /*
  * The location of a potential clone, identified through the file
@@ -52,7 +60,8 @@ public:
         begin_offset((token_offset_type)begin_offset) {}
 
     friend bool operator<(const CloneLocation& lhs, const CloneLocation& rhs) {
-        return lhs.file_id < rhs.file_id || lhs.begin_offset < rhs.begin_offset;
+        return lhs.file_id < rhs.file_id
+            || (lhs.file_id == rhs.file_id && lhs.begin_offset < rhs.begin_offset);
     }
 
     friend std::ostream& operator<<(std::ostream& os, const CloneLocation &l) {
@@ -104,11 +113,6 @@ public:
         end_offset = offset;
     }
 
-    // Extend the clone's coverage by one token
-    void extend_by_one() {
-        ++end_offset;
-    }
-
     // Return true if the clone is entirely shadowed by the passed one
     bool is_shadowed(const Clone& shadow) const {
         return shadow.begin_offset <= begin_offset
@@ -134,17 +138,50 @@ public:
  * For the comparison to work its pointer to the token container must be set.
  */
 class SeenTokens : public CloneLocation {
+public:
+    typedef std::uint64_t prefix_type;
+
 private:
     // Container holding the encountered tokens
     static const TokenContainer* token_container;
 
     // Length of identified token sequences
     static unsigned clone_length;
+
+    // Comparison of windows of that length
+    static WindowCompare window_compare;
+
+    /*
+     * The window's first two tokens, packed so that prefixes order
+     * as their windows do.  Most comparisons are decided on them,
+     * without accessing the tokens.
+     */
+    prefix_type prefix;
+
+    /*
+     * Index of the window's first token in the container's arena.
+     * Tokens are accessed through the arena's current storage,
+     * which can move as more input is read.
+     */
+    std::size_t token_index;
+
+    // Return an iterator to the window's tokens
+    FileData::tokens_type::const_iterator tokens() const {
+        return token_container->get_arena().tokens.begin() + token_index;
+    }
+
 public:
     // Construct from a file id and token offset
     SeenTokens(TokenContainer::file_id_type file_id,
             FileData::token_offset_type token_offset) :
-        CloneLocation(file_id, token_offset) {}
+        CloneLocation(file_id, token_offset),
+        token_index(token_container->get_file(file_id).get_token_begin()
+                + token_offset) {
+        auto t = tokens();
+        prefix = prefix_type(t[0]) << 32;
+        if (clone_length > 1)
+            prefix |= t[1];
+    }
 
     static void set_token_container(const TokenContainer* tc) {
         token_container = tc;
@@ -153,60 +190,213 @@ public:
         return token_container;
     }
 
-    static void set_clone_length(unsigned cl) { clone_length = cl; }
+    /*
+     * Set the length of the compared sequences, selecting a comparison
+     * specialized for it, if one is available
+     */
+    static void set_clone_length(unsigned cl) {
+        clone_length = cl;
+        window_compare = WindowCompare(cl);
+    }
     static unsigned get_clone_length() { return clone_length; }
 
     friend bool operator<(const SeenTokens& lhs, const SeenTokens& rhs);
 };
 
+// Engines available for indexing clone candidates
+enum class IndexEngine {
+    map,        // Ordered tree of token windows
+    hash,       // Hash table of window fingerprints
+    sort,       // Sorted array of window fingerprints
+    suffix,     // Suffix and LCP arrays of the concatenated files
+};
+
+// Formats in which clones can be reported
+enum class ReportFormat {
+    text,       // Tab-separated lines
+    json,       // A JSON array of clone groups
+    ndjson,     // A JSON object per line for each group and file
+    binary,     // Variable-length integer records
+    pairs,      // Comma-separated lines with a pair of clones
+    binary_pairs,   // Variable-length integer records of clone pairs
+};
+
+// Options controlling the reporting of clones
+struct ReportOptions {
+    ReportFormat format = ReportFormat::text;
+
+    // Pair each clone with all others, rather than the group's first one
+    bool all_pairs = false;
+
+    // Maximum number of pairs reported for each group; zero for no limit
+    std::size_t max_pairs = 0;
+};
+
+// Options controlling the detection of clones
+struct DetectorOptions {
+    // Engine used for indexing clone candidates
+    IndexEngine engine = IndexEngine::map;
+
+    // Number of threads to use
+    unsigned nthreads = 1;
+
+    // Consider partially overlapped clones as shadowed
+    bool partial_overlap = false;
+
+    // Index only the windows a first pass over all files finds repeated
+    bool prefilter = false;
+
+    /*
+     * Bytes of memory for indexing candidates, which are then kept
+     * in sorted runs on disk; zero for an in-memory index
+     */
+    std::size_t memory_limit = 0;
+
+    // Detect only the clones of the windows in this shard
+    WindowShard shard;
+
+    // Index the code blocks of files as they are indexed
+    bool block_regions = false;
+
+    // Tokens opening and closing code blocks
+    FileData::token_type block_open = '{';
+    FileData::token_type block_close = '}';
+};
+
+class BlockIndex;
+class CandidateIndex;
+class WindowSketch;
+
 class CloneDetector {
 public:
-    typedef std::vector<CloneLocation> seen_locations_type;
+    // Most windows are seen once or twice, and are then stored inline
+    typedef SmallVector<CloneLocation, 2> seen_locations_type;
+    typedef std::map<SeenTokens, seen_locations_type, std::less<SeenTokens>,
+            PoolAllocator<std::pair<const SeenTokens, seen_locations_type>>>
+        candidates_type;
+    typedef GroupedVector<Clone> clone_groups_type;
 
 private:
     // Container of all tokens
     const TokenContainer &token_container;
 
     // Tokens that have been encountered in the examined code (token_container)
-    std::map<SeenTokens, seen_locations_type> clone_candidates;
+    candidates_type clone_candidates;
+
+    /*
+     * Alternative index of encountered tokens; null for the map engine.
+     * Its windows seen more than once are moved into clone_candidates
+     * when non-clones are pruned.
+     */
+    std::unique_ptr<CandidateIndex> candidate_index;
 
     // Minimum length of clones to be detected
     unsigned clone_length;
 
+    // True while files are only recorded for a prefiltered indexing
+    bool prefilter;
+
+    // Files recorded for prefiltered indexing
+    std::vector<TokenContainer::file_id_type> prefilter_files;
+
+    // Sketch of all windows, used for prefiltering them
+    std::unique_ptr<WindowSketch> sketch;
+
+    // Number of windows, and of those that are unique
+    std::size_t prefilter_windows = 0;
+    std::size_t prefilter_unique_windows = 0;
+
+    // Number of unique windows the sketch reported as repeated
+    std::size_t prefilter_false_positives = 0;
+
+    // Number of threads to use
+    unsigned nthreads;
+
+    // Consider partially overlapped clones as shadowed
+    bool partial_overlap;
+
+    // Windows whose clones are detected
+    WindowShard shard;
+
+    // Tokens opening and closing code blocks
+    FileData::token_type block_open, block_close;
+
+    /*
+     * Matching ends of the code blocks, built while files are indexed
+     * or when block clones are created
+     */
+    std::unique_ptr<BlockIndex> block_index;
+
     // List of found clones
-    std::list<std::list<Clone>> clones;
+    clone_groups_type clones;
+
+    /*
+     * When detecting the clones of a shard, or merging shards,
+     * the window from which each clone group was created
+     */
+    std::vector<CloneLocation> group_leaders;
+
+    // True for each shard whose groups have been read
+    std::vector<bool> read_shards;
 
     // Add a new token sequence that has been encountered
     void insert(const SeenTokens &tokens, const CloneLocation location) {
-        auto it = clone_candidates.find(tokens);
-        if (it == clone_candidates.end())
-            clone_candidates.insert(it, std::make_pair(tokens, seen_locations_type{location}));
+        auto it = clone_candidates.lower_bound(tokens);
+        if (it == clone_candidates.end() || tokens < it->first)
+            clone_candidates.emplace_hint(it, tokens, seen_locations_type{location});
         else
             it->second.push_back(location);
     }
 
-    /*
-     * Return the token immediately past the end (i.e. at the end)
-     * of the specified clone.
-     * If the end coincides with the file's end, return 0.
-     */
-    FileData::token_type get_end_token(const Clone& clone) {
-        return token_container.get_token(clone.get_file_id(),
-                clone.get_end_token_offset());
-    }
-
     // Trim the clone extent to the nearest EOL
-    void trim_to_eol(Clone& clone) {
+    void trim_to_eol(Clone& clone) const {
         clone.set_end_token_offset(token_container.get_preceding_eol_offset(
                     clone.get_file_id(),
                     clone.get_end_token_offset()));
     }
 
-    // Create candidate clone into "clone"
+    // Create candidate clones into "groups"
+    void create_line_region_clone(const SeenTokens& leader,
+        const seen_locations_type& members, clone_groups_type& groups) const;
     bool create_block_region_clone(const SeenTokens& leader,
-        const seen_locations_type& members, int offset);
+        const seen_locations_type& members, int offset,
+        clone_groups_type& groups) const;
+
+    /*
+     * Call create(leader, members, groups) for all clone candidates
+     * using multiple threads, and append the created groups
+     * to "clones" in the order of the candidates.
+     */
+    template <typename F>
+    void create_clone_groups(F create);
+    template <typename F>
+    void create_clone_groups(const candidates_type &candidates, F create);
+
+    // Extend the group's clones to subsequent lines if possible
+    void extend_clone_group(clone_groups_type::range clone_group) const;
+
+    // Sketch the recorded files' windows and index the repeated ones
+    void apply_prefilter();
+
+    // Write the file's binary record, unless already reported
+    void report_binary_file(OutputWriter &out,
+            std::vector<bool> &file_reported,
+            TokenContainer::file_id_type file_id) const;
 public:
-    CloneDetector(const TokenContainer &tc, unsigned clone_length);
+    /*
+     * Construct given a token container and the minimum clone length.
+     * The files already in the container are indexed as clone candidates.
+     */
+    CloneDetector(const TokenContainer &tc, unsigned clone_length,
+            const DetectorOptions &options = DetectorOptions());
+
+    ~CloneDetector();
+
+    /*
+     * Index the specified file of the container as clone candidates.
+     * This allows files to be added while the container is being read.
+     */
+    void index_file(const FileData &file);
 
     // Prune-away recorded tokens not associated with clones
     void prune_non_clones();
@@ -219,43 +409,70 @@ public:
     void extend_clones();
 
     // Clear the clone_candidates data structure
-    void clear_clone_candidates() { clone_candidates.clear(); }
+    void clear_clone_candidates();
 
     // Remove clone groups whose members are entirely shadowed by others
     void remove_shadowed_groups();
 
+    /*
+     * Write the clone groups of a shard, before their shadowing is
+     * checked, in a form that can be merged with those of other shards
+     */
+    void write_shard(std::ostream &out) const;
+
+    /*
+     * Add the clone groups of a shard written by write_shard from the
+     * same input and clone length; throw std::runtime_error on errors
+     */
+    void read_shard(std::istream &in);
+
+    /*
+     * Order the groups read from all shards as those of a single
+     * process; throw std::runtime_error if a shard is missing
+     */
+    void merge_shards();
+
     // Return a read-only view of all clones
     ConstCollectionView<decltype(clones)> clone_view() const {
         return clones;
     }
 
     // Report found clones
-    void report_text() const;
-    void report_json() const;
+    void report_text(OutputWriter &out) const;
+    void report_json(OutputWriter &out) const;
+    void report_ndjson(OutputWriter &out) const;
+    void report_binary(OutputWriter &out) const;
+
+    // Report pairs of clones in the same group
+    void report_pairs(OutputWriter &out, const ReportOptions &options) const;
+    void report_binary_pairs(OutputWriter &out,
+            const ReportOptions &options) const;
+
+    // Report found clones as specified by the options
+    void report(OutputWriter &out,
+            const ReportOptions &options = ReportOptions()) const;
 
     // Return the number of sites for potential clones (for testing)
-    int get_number_of_seen_sites() { return clone_candidates.size(); }
+    int get_number_of_seen_sites();
 
     // Return the number of potential clones found (for testing)
-    int get_number_of_seen_clones() {
-        int nclones = 0;
-        for (const auto& it : clone_candidates) {
-            size_t nelem = it.second.size();
-            if (nelem > 1)
-                nclones += nelem;
-        }
-        return nclones;
+    int get_number_of_seen_clones();
+
+    /*
+     * Return the number of unique windows, and the number of those
+     * that passed the prefilter; available after pruning
+     */
+    std::size_t get_number_of_unique_windows() const {
+        return prefilter_unique_windows;
+    }
+    std::size_t get_number_of_prefilter_false_positives() const {
+        return prefilter_false_positives;
     }
 
     // Return the number of actual clone groups
     int get_number_of_clone_groups() { return clones.size(); }
 
-    int get_number_of_clones() {
-        int nclones = 0;
-        for (const auto& it : clones)
-            nclones += it.size();
-        return nclones;
-    }
+    int get_number_of_clones() { return clones.element_size(); }
 
     /*
      * Return the total number of clone tokens covered by clone groups.
@@ -264,7 +481,7 @@ public:
     std::size_t get_number_of_clone_tokens()
     {
         std::size_t ntokens = 0;
-        for (auto& clone_group : clones)
+        for (const auto& clone_group : clones)
             ntokens += clone_group.front().size();
         return ntokens;
     }
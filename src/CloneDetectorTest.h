@@ -1,18 +1,47 @@
 #pragma once
 
 #include <cppunit/extensions/HelperMacros.h>
+#include <stdexcept>
 
+#include <unistd.h>
+
+#include "BlockIndex.h"
 #include "CloneDetector.h"
+#include "SuffixIndex.h"
+#include "TokenCompare.h"
+#include "WindowHasher.h"
 
 class CloneDetectorTest : public CppUnit::TestFixture  {
     CPPUNIT_TEST_SUITE(CloneDetectorTest);
     CPPUNIT_TEST(test_size);
     CPPUNIT_TEST(test_seen_compare);
+    CPPUNIT_TEST(test_seen_prefix);
     CPPUNIT_TEST(test_seen_container);
     CPPUNIT_TEST(test_insert);
+    CPPUNIT_TEST(test_index_file_while_reading);
     CPPUNIT_TEST(test_prune_non_clones);
+    CPPUNIT_TEST(test_window_hasher);
+    CPPUNIT_TEST(test_token_kernels);
+    CPPUNIT_TEST(test_grouped_vector);
+    CPPUNIT_TEST(test_seen_locations);
+    CPPUNIT_TEST(test_hash_engine);
+    CPPUNIT_TEST(test_sharded_hash_engine);
+    CPPUNIT_TEST(test_sort_engine);
+    CPPUNIT_TEST(test_prefilter);
+    CPPUNIT_TEST(test_suffix_array);
+    CPPUNIT_TEST(test_suffix_engine);
+    CPPUNIT_TEST(test_spill_engine);
+    CPPUNIT_TEST(test_merge_shards);
     CPPUNIT_TEST(test_create_line_region_clones);
+    CPPUNIT_TEST(test_report);
+    CPPUNIT_TEST(test_report_streams);
+    CPPUNIT_TEST(test_report_pairs);
+    CPPUNIT_TEST(test_output_writer);
+    CPPUNIT_TEST(test_create_clones_parallel);
     CPPUNIT_TEST(test_create_block_region_clones_bce);
+    CPPUNIT_TEST(test_block_index);
+    CPPUNIT_TEST(test_block_index_words);
+    CPPUNIT_TEST(test_create_block_region_clones_delimiters);
     CPPUNIT_TEST(test_create_block_region_clones_same_prefix);
     CPPUNIT_TEST(test_create_block_region_clones_simple);
     CPPUNIT_TEST(test_create_block_region_clones_offset_success);
@@ -25,7 +54,10 @@ class CloneDetectorTest : public CppUnit::TestFixture  {
     CPPUNIT_TEST(test_extend_clones_same);
     CPPUNIT_TEST(test_extend_clones_different);
     CPPUNIT_TEST(test_extend_clones_two_lines);
+    CPPUNIT_TEST(test_extend_clones_file_end);
     CPPUNIT_TEST(test_remove_shadowed_groups);
+    CPPUNIT_TEST(test_remove_shadowed_groups_same_extent);
+    CPPUNIT_TEST(test_remove_overlapped_groups);
     CPPUNIT_TEST_SUITE_END();
 public:
     void test_size() {
@@ -48,6 +80,25 @@ public:
         CPPUNIT_ASSERT(!(s1 < s3));
     }
 
+    void test_seen_prefix() {
+        //                             0  1  2    3  4  5  6 7 8    9
+        std::istringstream iss("Fname\n12 42 4\n12 42 9\n5 9\n5 7\n");
+        TokenContainer tc(iss);
+        {
+            // Windows differing after their inline prefix
+            CloneDetector cd(tc, 3);
+            CPPUNIT_ASSERT(SeenTokens(0, 0) < SeenTokens(0, 3));
+            CPPUNIT_ASSERT(!(SeenTokens(0, 3) < SeenTokens(0, 0)));
+        }
+        {
+            // Windows shorter than the prefix
+            CloneDetector cd(tc, 1);
+            CPPUNIT_ASSERT(!(SeenTokens(0, 6) < SeenTokens(0, 8)));
+            CPPUNIT_ASSERT(!(SeenTokens(0, 8) < SeenTokens(0, 6)));
+            CPPUNIT_ASSERT(SeenTokens(0, 6) < SeenTokens(0, 0));
+        }
+    }
+
     void test_seen_container() {
         //                             0  1  2    3  4  5  6  7  8 9 10 11 12 13
         std::istringstream iss("Fname\n12 42 4\n\n7\n12 42 9\n7\n5 9\n5 9\n5 9\n");
@@ -70,6 +121,29 @@ public:
         CPPUNIT_ASSERT_EQUAL(5, cd.get_number_of_seen_clones());
     }
 
+    void test_index_file_while_reading() {
+        int fds[2];
+        CPPUNIT_ASSERT(pipe(fds) == 0);
+        std::string s("Fa\n12 42 4\n\n7\nFb\n12 42 9\n7\n5 10\n5 10\n5 10\n");
+        CPPUNIT_ASSERT(write(fds[1], s.data(), s.size()) == (ssize_t)s.size());
+        close(fds[1]);
+
+        TokenContainer tc;
+        CloneDetector cd(tc, 2);
+        CPPUNIT_ASSERT_EQUAL(0, cd.get_number_of_seen_sites());
+        int nfiles = 0;
+        tc.read(fds[0], 1, [&](const FileData &file) {
+            CPPUNIT_ASSERT_EQUAL(file_id_type(nfiles), file.get_id());
+            nfiles++;
+            cd.index_file(file);
+        });
+        close(fds[0]);
+
+        CPPUNIT_ASSERT_EQUAL(2, nfiles);
+        CPPUNIT_ASSERT_EQUAL(3, cd.get_number_of_seen_sites());
+        CPPUNIT_ASSERT_EQUAL(5, cd.get_number_of_seen_clones());
+    }
+
     void test_prune_non_clones() {
         std::istringstream iss("Fname\n12 42 4\n\n7\n12 42 9\n7\n5 10\n5 10\n5 10\n");
         TokenContainer tc(iss);
@@ -79,6 +153,347 @@ public:
         CPPUNIT_ASSERT_EQUAL(5, cd.get_number_of_seen_clones());
     }
 
+    void test_window_hasher() {
+        //                      Offset: 0  1  2 3 4    5  6  7 8 9 10
+        std::istringstream iss("Fname\n12 42 4\n1 2\n\n12 42 4\n1 2\n5\n");
+        TokenContainer tc(iss);
+        WindowHasher hasher(4);
+
+        std::vector<FileData::token_offset_type> offsets;
+        std::vector<WindowHasher::fingerprint_type> fingerprints;
+        hasher.for_each_window(*tc.file_view().begin(), [&](
+                    FileData::token_offset_type o,
+                    WindowHasher::fingerprint_type f) {
+            offsets.push_back(o);
+            fingerprints.push_back(f);
+        });
+        CPPUNIT_ASSERT_EQUAL(std::size_t(3), offsets.size());
+        CPPUNIT_ASSERT_EQUAL(FileData::token_offset_type(3), offsets[1]);
+        CPPUNIT_ASSERT_EQUAL(FileData::token_offset_type(5), offsets[2]);
+        // Rolled and freshly computed hashes of equal windows are equal
+        CPPUNIT_ASSERT_EQUAL(fingerprints[0], fingerprints[2]);
+        CPPUNIT_ASSERT(fingerprints[0] != fingerprints[1]);
+    }
+
+    // Return a textual representation of the detector's clones
+    static std::string clones_string(const CloneDetector &cd) {
+        std::ostringstream out;
+        for (const auto& clone_group: cd.clone_view()) {
+            for (const auto& clone: clone_group)
+                out << clone << ' ';
+            out << '\n';
+        }
+        return out.str();
+    }
+
+    void test_token_kernels() {
+        CPPUNIT_ASSERT(!supported_token_kernels().empty());
+        for (const auto& kernel : supported_token_kernels())
+            for (std::size_t n = 0; n <= 40; n++) {
+                std::vector<FileData::token_type> a(n), b;
+                for (std::size_t i = 0; i < n; i++)
+                    a[i] = 0x80000000U + i;
+                b = a;
+                CPPUNIT_ASSERT_EQUAL(n, kernel.mismatch(a.data(), b.data(), n));
+                for (std::size_t i = 0; i < n; i++) {
+                    b[i]++;
+                    CPPUNIT_ASSERT_EQUAL(i, kernel.mismatch(a.data(), b.data(), n));
+                    b[n - 1]++;
+                    CPPUNIT_ASSERT_EQUAL(i, kernel.mismatch(a.data(), b.data(), n));
+                    b = a;
+                }
+            }
+
+        for (const auto& kernel : supported_token_kernels())
+            for (unsigned n : {15, 20, 30, 40, 50}) {
+                token_mismatch_type fixed = kernel.fixed(n);
+                if (!fixed)
+                    continue;
+                std::vector<FileData::token_type> a(n, 7), b(a);
+                CPPUNIT_ASSERT_EQUAL(std::size_t(n), fixed(a.data(), b.data(), n));
+                for (std::size_t i = 0; i < n; i++) {
+                    b[i] = 8;
+                    CPPUNIT_ASSERT_EQUAL(i, fixed(a.data(), b.data(), n));
+                    b[i] = 7;
+                }
+            }
+        CPPUNIT_ASSERT(!supported_token_kernels().back().fixed(17));
+
+        std::istringstream iss("Fa\n1 2 3 4\n1 2 4 0\n");
+        TokenContainer tc(iss);
+        auto tokens = tc.get_file(0).offset_begin(0);
+        CPPUNIT_ASSERT(token_compare(tokens, tokens + 4, 3) < 0);
+        CPPUNIT_ASSERT(token_compare(tokens + 4, tokens, 3) > 0);
+        CPPUNIT_ASSERT_EQUAL(0, token_compare(tokens, tokens + 4, 2));
+        CPPUNIT_ASSERT(tokens_equal(tokens, tokens + 4, 2));
+        CPPUNIT_ASSERT(!tokens_equal(tokens, tokens + 4, 3));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(2), token_mismatch(tokens, tokens + 4, 4));
+        CPPUNIT_ASSERT(WindowCompare(3).compare(tokens, tokens + 4) < 0);
+        CPPUNIT_ASSERT(WindowCompare(2).equal(tokens, tokens + 4));
+    }
+
+    void test_grouped_vector() {
+        CloneDetector::clone_groups_type groups, more;
+        groups.push_back(Clone(0, 1, 2));
+        groups.push_back(Clone(1, 1, 2));
+        groups.end_group();
+        groups.push_back(Clone(2, 1, 2));
+        groups.discard_group();
+        more.push_back(Clone(3, 1, 2));
+        more.end_group();
+        more.push_back(Clone(4, 1, 2));
+        more.push_back(Clone(5, 1, 2));
+        more.push_back(Clone(6, 1, 2));
+        more.end_group();
+        groups.append(more);
+        CPPUNIT_ASSERT(more.empty());
+        CPPUNIT_ASSERT_EQUAL(size_t(3), groups.size());
+        CPPUNIT_ASSERT_EQUAL(size_t(6), groups.element_size());
+        CPPUNIT_ASSERT_EQUAL(size_t(3), groups[2].size());
+        CPPUNIT_ASSERT_EQUAL(4u, groups[2].front().get_file_id());
+
+        groups.remove_if([](CloneDetector::clone_groups_type::const_range g) {
+            return g.size() == 1;
+        });
+        std::ostringstream out;
+        for (const auto& group : groups) {
+            for (const auto& clone : group)
+                out << clone << ' ';
+            out << '\n';
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("0.1-2 1.1-2 \n4.1-2 5.1-2 6.1-2 \n"), out.str());
+    }
+
+    void test_seen_locations() {
+        CloneDetector::seen_locations_type locations{CloneLocation(0, 1)};
+        locations.push_back(CloneLocation(1, 1));
+        CPPUNIT_ASSERT(locations.is_inline());
+        for (unsigned i = 2; i < 5; i++)
+            locations.push_back(locations[i - 2]);
+        CPPUNIT_ASSERT(!locations.is_inline());
+        CPPUNIT_ASSERT_EQUAL(5u, locations.size());
+        CPPUNIT_ASSERT_EQUAL(0u, locations[4].get_file_id());
+
+        CloneDetector::seen_locations_type copy(locations);
+        CloneDetector::seen_locations_type moved(std::move(locations));
+        CPPUNIT_ASSERT(locations.empty());
+        CPPUNIT_ASSERT(std::equal(copy.begin(), copy.end(), moved.begin(),
+            [](const CloneLocation &a, const CloneLocation &b) {
+                return !(a < b) && !(b < a);
+            }));
+    }
+
+    // Return the clones found in the specified input using options
+    static std::string engine_clones(const std::string &input,
+            unsigned clone_length, const DetectorOptions &options) {
+        std::istringstream iss(input);
+        TokenContainer tc(iss);
+        CloneDetector cd(tc, clone_length, options);
+        cd.prune_non_clones();
+        cd.create_line_region_clones();
+        cd.extend_clones();
+        return clones_string(cd);
+    }
+
+    // Input with repeated windows for comparing engines
+    static std::string engine_input() {
+        return "Fa\n12 42 4\n\n7\n12 42 9\n7\n15 10\n15 10 25\n15 10\n"
+            "Fb\n1 2 3\n4 5\n15 10\n15 10 25\n3\n12 42 9\n7\n"
+            "Fc\n1 2 3\n4 5\n15 10\n15 10 25\n3\n12 42 9\n7\n";
+    }
+
+    void test_hash_engine() {
+        DetectorOptions map_options, hash_options;
+        hash_options.engine = IndexEngine::hash;
+
+        std::string expected(engine_clones(engine_input(), 2, map_options));
+        CPPUNIT_ASSERT(!expected.empty());
+        CPPUNIT_ASSERT_EQUAL(expected, engine_clones(engine_input(), 2, hash_options));
+
+        std::istringstream iss(engine_input());
+        TokenContainer tc(iss);
+        CloneDetector map_cd(tc, 3, map_options);
+        CloneDetector hash_cd(tc, 3, hash_options);
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_sites(), hash_cd.get_number_of_seen_sites());
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_clones(), hash_cd.get_number_of_seen_clones());
+    }
+
+    void test_sharded_hash_engine() {
+        DetectorOptions map_options, hash_options;
+        hash_options.engine = IndexEngine::hash;
+        hash_options.nthreads = 3;
+
+        std::string expected(engine_clones(engine_input(), 2, map_options));
+        CPPUNIT_ASSERT_EQUAL(expected, engine_clones(engine_input(), 2, hash_options));
+
+        std::istringstream iss(engine_input());
+        TokenContainer tc(iss);
+        CloneDetector map_cd(tc, 3, map_options);
+        CloneDetector hash_cd(tc, 3, hash_options);
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_sites(), hash_cd.get_number_of_seen_sites());
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_clones(), hash_cd.get_number_of_seen_clones());
+    }
+
+    void test_sort_engine() {
+        DetectorOptions map_options, sort_options;
+        sort_options.engine = IndexEngine::sort;
+        sort_options.nthreads = 3;
+
+        std::string expected(engine_clones(engine_input(), 2, map_options));
+        CPPUNIT_ASSERT_EQUAL(expected, engine_clones(engine_input(), 2, sort_options));
+
+        std::istringstream iss(engine_input());
+        TokenContainer tc(iss);
+        CloneDetector map_cd(tc, 3, map_options);
+        CloneDetector sort_cd(tc, 3, sort_options);
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_sites(), sort_cd.get_number_of_seen_sites());
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_clones(), sort_cd.get_number_of_seen_clones());
+    }
+
+    void test_prefilter() {
+        DetectorOptions plain_options;
+        std::string expected(engine_clones(engine_input(), 2, plain_options));
+
+        for (auto engine : {IndexEngine::map, IndexEngine::hash, IndexEngine::sort}) {
+            DetectorOptions options;
+            options.engine = engine;
+            options.prefilter = true;
+            CPPUNIT_ASSERT_EQUAL(expected, engine_clones(engine_input(), 2, options));
+
+            std::istringstream iss(engine_input());
+            TokenContainer tc(iss);
+            CloneDetector cd(tc, 3, options);
+            cd.prune_non_clones();
+            // Windows of three tokens appearing only once
+            CPPUNIT_ASSERT_EQUAL(std::size_t(3), cd.get_number_of_unique_windows());
+            CPPUNIT_ASSERT_EQUAL(std::size_t(0), cd.get_number_of_prefilter_false_positives());
+        }
+    }
+
+    void test_suffix_array() {
+        // Compare against naive sorting on texts with many repeats
+        for (unsigned seed = 1; seed <= 50; seed++) {
+            SuffixIndex::text_type text;
+            unsigned r = seed;
+            for (unsigned i = 0; i < seed * 3; i++) {
+                r = r * 1103515245 + 12345;
+                text.push_back((r >> 16) % (seed % 4 + 2));
+            }
+            SuffixIndex::index_type max_value = text.empty() ? 0
+                : *std::max_element(text.begin(), text.end());
+
+            SuffixIndex::text_type expected(text.size());
+            for (unsigned i = 0; i < text.size(); i++)
+                expected[i] = i;
+            std::sort(expected.begin(), expected.end(), [&](int a, int b) {
+                return std::lexicographical_compare(text.begin() + a,
+                        text.end(), text.begin() + b, text.end());
+            });
+            auto sa = SuffixIndex::suffix_array(text, max_value);
+            CPPUNIT_ASSERT(expected == sa);
+
+            auto plcp = SuffixIndex::plcp_array(text, sa);
+            for (unsigned i = 1; i < sa.size(); i++) {
+                int l = 0;
+                while (sa[i] + l < int(text.size())
+                        && sa[i - 1] + l < int(text.size())
+                        && text[sa[i] + l] == text[sa[i - 1] + l])
+                    l++;
+                CPPUNIT_ASSERT_EQUAL(l, plcp[sa[i]]);
+            }
+        }
+    }
+
+    void test_suffix_engine() {
+        DetectorOptions map_options, suffix_options;
+        suffix_options.engine = IndexEngine::suffix;
+
+        std::string expected(engine_clones(engine_input(), 2, map_options));
+        CPPUNIT_ASSERT_EQUAL(expected, engine_clones(engine_input(), 2, suffix_options));
+
+        std::istringstream iss(engine_input());
+        TokenContainer tc(iss);
+        CloneDetector map_cd(tc, 3, map_options);
+        CloneDetector suffix_cd(tc, 3, suffix_options);
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_sites(), suffix_cd.get_number_of_seen_sites());
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_clones(), suffix_cd.get_number_of_seen_clones());
+    }
+
+    void test_spill_engine() {
+        DetectorOptions map_options, spill_options;
+        // Spill many small runs, and merge them into many batches
+        spill_options.memory_limit = 64;
+        spill_options.nthreads = 3;
+
+        std::string input(engine_input() + engine_input());
+        std::string expected(engine_clones(input, 2, map_options));
+        CPPUNIT_ASSERT_EQUAL(expected, engine_clones(input, 2, spill_options));
+        spill_options.prefilter = true;
+        CPPUNIT_ASSERT_EQUAL(expected, engine_clones(input, 2, spill_options));
+        spill_options.prefilter = false;
+
+        std::istringstream iss(input);
+        TokenContainer tc(iss);
+        CloneDetector map_cd(tc, 3, map_options);
+        CloneDetector spill_cd(tc, 3, spill_options);
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_sites(), spill_cd.get_number_of_seen_sites());
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_clones(), spill_cd.get_number_of_seen_clones());
+        map_cd.prune_non_clones();
+        spill_cd.prune_non_clones();
+        CPPUNIT_ASSERT_EQUAL(map_cd.get_number_of_seen_sites(), spill_cd.get_number_of_seen_sites());
+    }
+
+    void test_merge_shards() {
+        std::string input(engine_input()
+                + "Fd\n1 2 3\n123 5 15 10\n15 10 25\n125 12 42 9\n7\n");
+        std::istringstream iss(input);
+        TokenContainer tc(iss);
+
+        for (auto engine : {IndexEngine::map, IndexEngine::hash, IndexEngine::suffix}) {
+            DetectorOptions options;
+            options.engine = engine;
+            CloneDetector single_cd(tc, 2, options);
+            single_cd.prune_non_clones();
+            single_cd.create_line_region_clones();
+            single_cd.extend_clones();
+            single_cd.remove_shadowed_groups();
+
+            const unsigned nshards = 3;
+            std::string shards[nshards];
+            for (unsigned i = 0; i < nshards; i++) {
+                options.shard.index = i;
+                options.shard.count = nshards;
+                CloneDetector shard_cd(tc, 2, options);
+                shard_cd.prune_non_clones();
+                shard_cd.create_line_region_clones();
+                shard_cd.extend_clones();
+                std::ostringstream out;
+                shard_cd.write_shard(out);
+                shards[i] = out.str();
+            }
+
+            // Merge the shards in a different order
+            CloneDetector merged_cd(tc, 2);
+            for (unsigned i : {2, 0, 1}) {
+                std::istringstream in(shards[i]);
+                merged_cd.read_shard(in);
+            }
+            merged_cd.merge_shards();
+            merged_cd.remove_shadowed_groups();
+            CPPUNIT_ASSERT(single_cd.get_number_of_clone_groups() > 0);
+            CPPUNIT_ASSERT_EQUAL(clones_string(single_cd), clones_string(merged_cd));
+
+            CloneDetector missing_cd(tc, 2);
+            std::istringstream in(shards[0]);
+            missing_cd.read_shard(in);
+            CPPUNIT_ASSERT_THROW(missing_cd.merge_shards(), std::runtime_error);
+
+            CloneDetector other_cd(tc, 3);
+            std::istringstream other_in(shards[0]);
+            CPPUNIT_ASSERT_THROW(other_cd.read_shard(other_in), std::runtime_error);
+        }
+    }
+
     void test_create_line_region_clones() {
         std::istringstream iss(
         //              0  1  2    3  4  5  6  7  8  9   10 11 12  13 14
@@ -91,6 +506,153 @@ public:
         CPPUNIT_ASSERT_EQUAL(2, cd.get_number_of_clones());
     }
 
+    void test_report() {
+        std::istringstream iss("Fa\"b\n12 42 4\n\n7\n12 42 4\n7\n");
+        TokenContainer tc(iss);
+        CloneDetector cd(tc, 3);
+        cd.prune_non_clones();
+        cd.create_line_region_clones();
+        cd.extend_clones();
+        cd.remove_shadowed_groups();
+
+        std::ostringstream text;
+        {
+            OutputWriter out(text);
+            cd.report_text(out);
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("2\t4\n1\t3\ta\"b\n4\t5\ta\"b\n\n"),
+                text.str());
+
+        std::ostringstream json;
+        OutputWriter out(json);
+        cd.report_json(out);
+        out.flush();
+        CPPUNIT_ASSERT(json.str().find("\"filepath\": \"a\\\"b\"\n")
+                != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(json.str().size(), out.size());
+    }
+
+    void test_report_streams() {
+        std::istringstream iss("Fa\"b\n12 42 4\n\n7\n12 42 4\n7\n");
+        TokenContainer tc(iss);
+        CloneDetector cd(tc, 3);
+        cd.prune_non_clones();
+        cd.create_line_region_clones();
+        cd.extend_clones();
+        cd.remove_shadowed_groups();
+
+        ReportOptions options;
+        std::ostringstream ndjson;
+        {
+            OutputWriter out(ndjson);
+            options.format = ReportFormat::ndjson;
+            cd.report(out, options);
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string(
+                    "{\"file\":0,\"path\":\"a\\\"b\"}\n"
+                    "{\"group\":0,\"tokens\":4,\"clones\":[[0,1,3],[0,4,5]]}\n"),
+                ndjson.str());
+
+        std::ostringstream binary;
+        {
+            OutputWriter out(binary);
+            options.format = ReportFormat::binary;
+            cd.report(out, options);
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("MPCDCLN\1"
+                    "\1\3a\"b"
+                    "\4\4\0\1\3\0\4\5", 21), binary.str());
+    }
+
+    void test_report_pairs() {
+        std::istringstream iss("Fd/a.c\n12 42 4\nFe/f/b.c\n12 42 4\nFc.c\n12 42 4\n");
+        TokenContainer tc(iss);
+        CloneDetector cd(tc, 3);
+        cd.prune_non_clones();
+        cd.create_line_region_clones();
+        cd.remove_shadowed_groups();
+        CPPUNIT_ASSERT_EQUAL(1, cd.get_number_of_clone_groups());
+
+        auto pairs = [&cd](const ReportOptions &options) {
+            std::ostringstream os;
+            OutputWriter out(os);
+            cd.report(out, options);
+            out.flush();
+            return os.str();
+        };
+
+        ReportOptions options;
+        options.format = ReportFormat::pairs;
+        CPPUNIT_ASSERT_EQUAL(std::string(
+                    "d,a.c,1,1,f,b.c,1,1\n"
+                    "d,a.c,1,1,,c.c,1,1\n"), pairs(options));
+
+        options.all_pairs = true;
+        CPPUNIT_ASSERT_EQUAL(std::string(
+                    "d,a.c,1,1,f,b.c,1,1\n"
+                    "d,a.c,1,1,,c.c,1,1\n"
+                    "f,b.c,1,1,,c.c,1,1\n"), pairs(options));
+
+        options.max_pairs = 2;
+        CPPUNIT_ASSERT_EQUAL(std::string(
+                    "d,a.c,1,1,f,b.c,1,1\n"
+                    "d,a.c,1,1,,c.c,1,1\n"), pairs(options));
+
+        options.all_pairs = false;
+        options.max_pairs = 1;
+        options.format = ReportFormat::binary_pairs;
+        CPPUNIT_ASSERT_EQUAL(std::string("MPCDPAR\1"
+                    "\1\5d/a.c" "\3\7e/f/b.c"
+                    "\0\3\0\1\1\1\1\1", 32), pairs(options));
+    }
+
+    void test_output_writer() {
+        std::ostringstream os;
+        std::string large(3 * 1024 * 1024, 'x');
+        {
+            OutputWriter out(os);
+            out << 0u << ' ' << std::size_t(18446744073709551615ULL) << ' '
+                << "a" << '\n';
+            out << large;
+            out << 42u;
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("0 18446744073709551615 a\n"),
+                os.str().substr(0, 25));
+        CPPUNIT_ASSERT_EQUAL(25 + large.size() + 2, os.str().size());
+        CPPUNIT_ASSERT_EQUAL(std::string("x42"), os.str().substr(os.str().size() - 3));
+
+        std::ostringstream varints;
+        {
+            OutputWriter out(varints);
+            out.write_varint(0).write_varint(127).write_varint(300);
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("\0\177\254\2", 4), varints.str());
+    }
+
+    void test_create_clones_parallel() {
+        std::string input(engine_input()
+                + "Fd\n1 2 3\n123 5 15 10\n15 10 25\n125 12 42 9\n7\n"
+                + "Fe\n1 2 3\n123 5 15 10\n15 10 25\n125 12 42 9\n7\n");
+        std::istringstream iss(input);
+        TokenContainer tc(iss);
+        DetectorOptions parallel_options;
+        parallel_options.nthreads = 3;
+
+        for (int block = 0; block <= 1; block++) {
+            CloneDetector serial_cd(tc, 2);
+            CloneDetector parallel_cd(tc, 2, parallel_options);
+            for (auto cd : {&serial_cd, &parallel_cd}) {
+                cd->prune_non_clones();
+                if (block)
+                    cd->create_block_region_clones();
+                else
+                    cd->create_line_region_clones();
+            }
+            CPPUNIT_ASSERT(serial_cd.get_number_of_clone_groups() > 0);
+            CPPUNIT_ASSERT_EQUAL(clones_string(serial_cd), clones_string(parallel_cd));
+        }
+    }
+
     // Note '{' == 123 and '}' == 125
     void test_create_block_region_clones_simple() {
         std::istringstream iss(
@@ -105,6 +667,55 @@ public:
         CPPUNIT_ASSERT_EQUAL(2, cd.get_number_of_clones());
     }
 
+    void test_block_index() {
+        std::istringstream iss(
+// Offset:      0   1  2    3   4   5    6   7   8
+        "Fa\n125 123 9\n123 125 125\n123 123 125\n"
+// Offset:      0   1   2  3
+        "Fb\n125 123 7 125\n");
+        TokenContainer tc(iss);
+        BlockIndex bi(tc, '{', '}', 2);
+        CPPUNIT_ASSERT_EQUAL(std::size_t(4), bi.size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(5), bi.block_end(0, 1));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(4), bi.block_end(0, 3));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(8), bi.block_end(0, 7));
+        CPPUNIT_ASSERT_EQUAL(BlockIndex::NO_BLOCK_END, bi.block_end(0, 6));
+        CPPUNIT_ASSERT_EQUAL(BlockIndex::NO_BLOCK_END, bi.block_end(0, 2));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(3), bi.block_end(1, 1));
+    }
+
+    void test_block_index_words() {
+        // Blocks 0-69 and 66-67, spanning two words of the bitmap
+        std::ostringstream input;
+        input << "Fa\n123";
+        for (int i = 1; i < 66; i++)
+            input << " 7";
+        input << " 123 125 7 125\n";
+        std::istringstream iss(input.str());
+        TokenContainer tc(iss);
+        BlockIndex bi(tc, '{', '}');
+        CPPUNIT_ASSERT_EQUAL(std::size_t(2), bi.size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(69), bi.block_end(0, 0));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(67), bi.block_end(0, 66));
+        CPPUNIT_ASSERT_EQUAL(BlockIndex::NO_BLOCK_END, bi.block_end(0, 65));
+        CPPUNIT_ASSERT_EQUAL(BlockIndex::NO_BLOCK_END, bi.block_end(0, 64));
+    }
+
+    void test_create_block_region_clones_delimiters() {
+        std::istringstream iss(
+// Line:        1          2  3
+        "Fname\n12 7 42 8\n9\n12 7 42 8\n");
+        TokenContainer tc(iss);
+        DetectorOptions options;
+        options.block_open = 7;
+        options.block_close = 8;
+        CloneDetector cd(tc, 2, options);
+        cd.prune_non_clones();
+        cd.create_block_region_clones();
+        CPPUNIT_ASSERT_EQUAL(1, cd.get_number_of_clone_groups());
+        CPPUNIT_ASSERT_EQUAL(2, cd.get_number_of_clones());
+    }
+
     void test_create_block_region_clones_same_prefix() {
         std::istringstream iss(
 // Line:        1    2   3              4  5    6   7
@@ -140,10 +751,8 @@ public:
         cd.prune_non_clones();
         cd.create_block_region_clones();
         cd.remove_shadowed_groups();
-        // TODO: ensure all shadowed groups are removed
-        // cd.report_text();
-        // CPPUNIT_ASSERT_EQUAL(1, cd.get_number_of_clone_groups());
-        // CPPUNIT_ASSERT_EQUAL(2, cd.get_number_of_clones());
+        CPPUNIT_ASSERT_EQUAL(1, cd.get_number_of_clone_groups());
+        CPPUNIT_ASSERT_EQUAL(2, cd.get_number_of_clones());
         bool found = false;
         for (const auto& clone_group: cd.clone_view()) {
             CPPUNIT_ASSERT_EQUAL(size_t(2), clone_group.size());
@@ -323,6 +932,21 @@ public:
         }
     }
 
+    void test_extend_clones_file_end() {
+        // Identical files must not be extended past their end
+        std::istringstream iss("Fa\n12 42 3\n4 5\nFb\n12 42 3\n4 5\n");
+        TokenContainer tc(iss);
+        CloneDetector cd(tc, 2);
+        cd.prune_non_clones();
+        cd.create_line_region_clones();
+        cd.extend_clones();
+
+        // Groups of the windows "4 5" and "12 42", each ending at offset 5
+        CPPUNIT_ASSERT_EQUAL(std::string("0.3-5 1.3-5 \n0.0-5 1.0-5 \n"),
+                clones_string(cd));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(7), cd.get_number_of_clone_tokens());
+    }
+
     void test_remove_shadowed_groups() {
         std::istringstream iss("Fname\n12 42 3\n4 7\n12 42 3\n4 7");
         TokenContainer tc(iss);
@@ -341,4 +965,39 @@ public:
         CPPUNIT_ASSERT_EQUAL(2, cd.get_number_of_clones());
         CPPUNIT_ASSERT_EQUAL(std::size_t(5), cd.get_number_of_clone_tokens());
     }
+
+    void test_remove_shadowed_groups_same_extent() {
+        // Groups a0-3 b0-3 c0-3; a3-6 c3-6
+        std::istringstream iss("Fa\n1 2 3\n4 5 6\nFb\n1 2 3\nFc\n1 2 3\n4 5 6\n");
+        TokenContainer tc(iss);
+        CloneDetector cd(tc, 3);
+        cd.prune_non_clones();
+        // Repeat the groups, creating copies with identical extents
+        const int ncopies = 20;
+        for (int i = 0; i < ncopies; i++)
+            cd.create_line_region_clones();
+        CPPUNIT_ASSERT_EQUAL(2 * ncopies, cd.get_number_of_clone_groups());
+
+        // The first copies shadow the others in all files
+        cd.remove_shadowed_groups();
+        CPPUNIT_ASSERT_EQUAL(2, cd.get_number_of_clone_groups());
+        CPPUNIT_ASSERT_EQUAL(5, cd.get_number_of_clones());
+    }
+
+    void test_remove_overlapped_groups() {
+        // Groups a0-3 b0-3; a1-3 b1-3 c1-3; a2-4 c2-4
+        std::istringstream iss("Fa\n1\n2\n3\n4\nFb\n1\n2\n3\n9\nFc\n5\n2\n3\n4\n");
+        TokenContainer tc(iss);
+        DetectorOptions options;
+        for (int partial = 0; partial <= 1; partial++) {
+            options.partial_overlap = partial;
+            CloneDetector cd(tc, 2, options);
+            cd.prune_non_clones();
+            cd.create_line_region_clones();
+            cd.extend_clones();
+            CPPUNIT_ASSERT_EQUAL(3, cd.get_number_of_clone_groups());
+            cd.remove_shadowed_groups();
+            CPPUNIT_ASSERT_EQUAL(partial ? 2 : 3, cd.get_number_of_clone_groups());
+        }
+    }
 };
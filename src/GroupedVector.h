@@ -0,0 +1,163 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A compact sequence of element groups
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+/*
+ * A sequence of groups of elements, stored in compressed sparse row
+ * form: the elements of all groups are kept contiguously in a single
+ * vector, and each group is delimited by the offset of its first
+ * element.
+ * A group is built by adding its elements, and then either ending it
+ * or discarding it.
+ */
+template <typename T>
+class GroupedVector {
+public:
+    typedef typename std::vector<T>::size_type size_type;
+
+    // The elements of a group
+    template <typename P>
+    class Range {
+        P first, last;
+    public:
+        Range(P first, P last) : first(first), last(last) {}
+        P begin() const { return first; }
+        P end() const { return last; }
+        size_type size() const { return last - first; }
+        typename std::iterator_traits<P>::reference front() const {
+            return *first;
+        }
+    };
+
+    typedef Range<T *> range;
+    typedef Range<const T *> const_range;
+
+    // An iterator over the groups
+    template <typename P>
+    class Iterator {
+        P elements;
+        const size_type *offset;
+    public:
+        Iterator(P elements, const size_type *offset) :
+            elements(elements), offset(offset) {}
+        Range<P> operator*() const {
+            return Range<P>(elements + offset[0], elements + offset[1]);
+        }
+        Iterator& operator++() { ++offset; return *this; }
+        bool operator==(const Iterator& other) const {
+            return offset == other.offset;
+        }
+        bool operator!=(const Iterator& other) const {
+            return offset != other.offset;
+        }
+    };
+
+    typedef Iterator<T *> iterator;
+    typedef Iterator<const T *> const_iterator;
+
+private:
+    // The elements of all groups, followed by those of an unended one
+    std::vector<T> elements;
+
+    // Offset of each group's first element, followed by the end
+    std::vector<size_type> offsets{0};
+
+public:
+    // Return the number of groups
+    size_type size() const { return offsets.size() - 1; }
+
+    bool empty() const { return size() == 0; }
+
+    // Return the number of elements in all groups
+    size_type element_size() const { return offsets.back(); }
+
+    range operator[](size_type i) {
+        return range(elements.data() + offsets[i],
+                elements.data() + offsets[i + 1]);
+    }
+
+    const_range operator[](size_type i) const {
+        return const_range(elements.data() + offsets[i],
+                elements.data() + offsets[i + 1]);
+    }
+
+    iterator begin() { return iterator(elements.data(), offsets.data()); }
+    iterator end() { return iterator(elements.data(), &offsets.back()); }
+
+    const_iterator begin() const {
+        return const_iterator(elements.data(), offsets.data());
+    }
+    const_iterator end() const {
+        return const_iterator(elements.data(), &offsets.back());
+    }
+
+    // Add an element to the group being built
+    void push_back(const T &element) { elements.push_back(element); }
+
+    // Return the number of elements in the group being built
+    size_type open_size() const { return elements.size() - offsets.back(); }
+
+    // Add the group being built to the sequence
+    void end_group() { offsets.push_back(elements.size()); }
+
+    // Discard the group being built
+    void discard_group() {
+        elements.erase(elements.begin() + offsets.back(), elements.end());
+    }
+
+    // Append the groups of the specified sequence, leaving it empty
+    void append(GroupedVector &other) {
+        size_type base = elements.size();
+        elements.insert(elements.end(), other.elements.begin(),
+                other.elements.begin() + other.offsets.back());
+        for (auto it = other.offsets.begin() + 1; it != other.offsets.end(); ++it)
+            offsets.push_back(base + *it);
+        other.clear();
+    }
+
+    // Remove the groups for which pred(group) returns true
+    template <typename Pred>
+    void remove_if(Pred pred) {
+        size_type out = 0;          // Elements retained
+        size_type ngroups = 0;      // Groups retained
+        size_type begin = 0;
+        for (size_type g = 0; g < size(); g++) {
+            size_type end = offsets[g + 1];
+            const_range group(elements.data() + begin, elements.data() + end);
+            if (!pred(group)) {
+                for (size_type i = begin; i < end; i++)
+                    elements[out++] = std::move(elements[i]);
+                offsets[++ngroups] = out;
+            }
+            begin = end;
+        }
+        elements.erase(elements.begin() + out, elements.end());
+        offsets.resize(ngroups + 1);
+    }
+
+    void clear() {
+        elements.clear();
+        offsets.assign(1, 0);
+    }
+};
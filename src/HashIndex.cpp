@@ -0,0 +1,134 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A hash table index of clone candidates
+ */
+
+#include <algorithm>
+
+#include "HashIndex.h"
+
+// Marks the end of a window's location list
+static const HashIndex::location_index_type NO_LOCATION = -1;
+
+// Initial number of table slots
+static const std::size_t INITIAL_TABLE_SIZE = 1024;
+
+HashIndex::HashIndex(const TokenContainer &tc, unsigned clone_length) :
+    token_container(tc), clone_length(clone_length), hasher(clone_length),
+    window_compare(clone_length),
+    table(INITIAL_TABLE_SIZE, Entry{0, 0, 0})
+{
+}
+
+// Return true if the windows at the two locations have equal tokens
+bool
+HashIndex::same_tokens(const CloneLocation &a, const CloneLocation &b) const
+{
+    auto a_begin = token_container.offset_begin(a.get_file_id(),
+            a.get_begin_token_offset());
+    auto b_begin = token_container.offset_begin(b.get_file_id(),
+            b.get_begin_token_offset());
+    return window_compare.equal(a_begin, b_begin);
+}
+
+// Double the table's size
+void
+HashIndex::grow()
+{
+    std::vector<Entry> old_table(table.size() * 2, Entry{0, 0, 0});
+    old_table.swap(table);
+
+    std::size_t mask = table.size() - 1;
+    for (const auto& entry : old_table) {
+        if (entry.count == 0)
+            continue;
+        std::size_t i = entry.fingerprint & mask;
+        while (table[i].count != 0)
+            i = (i + 1) & mask;
+        table[i] = entry;
+    }
+}
+
+// Add the window at the specified location with the given fingerprint
+void
+HashIndex::insert(WindowHasher::fingerprint_type fingerprint,
+        const CloneLocation &location)
+{
+    // Keep the load factor at most 1/2
+    if (2 * (nentries + 1) > table.size())
+        grow();
+
+    location_index_type new_index = locations.size();
+    std::size_t mask = table.size() - 1;
+    for (std::size_t i = fingerprint & mask;; i = (i + 1) & mask) {
+        Entry &entry = table[i];
+        if (entry.count == 0) {
+            entry = Entry{fingerprint, new_index, 1};
+            locations.push_back(location);
+            next.push_back(NO_LOCATION);
+            nentries++;
+            return;
+        }
+
+        if (entry.fingerprint == fingerprint
+                && same_tokens(locations[entry.first], location)) {
+            locations.push_back(location);
+            next.push_back(next[entry.first]);
+            next[entry.first] = new_index;
+            nclones += ++entry.count == 2 ? 2 : 1;
+            return;
+        }
+    }
+}
+
+void
+HashIndex::index_file(const FileData &file)
+{
+    hasher.for_each_window(file, [&](FileData::token_offset_type offset,
+                WindowHasher::fingerprint_type fingerprint) {
+        insert(fingerprint, CloneLocation(file.get_id(), offset));
+    });
+}
+
+/*
+ * Move the windows seen more than once into the specified map,
+ * with their locations in indexing order, and free the index.
+ */
+void
+HashIndex::move_clones(CloneDetector::candidates_type &candidates)
+{
+    for (const auto& entry : table) {
+        if (entry.count < 2)
+            continue;
+
+        const CloneLocation &first = locations[entry.first];
+        CloneDetector::seen_locations_type members;
+        members.reserve(entry.count);
+        members.push_back(first);
+        // Subsequent locations are linked in reverse order
+        for (auto i = next[entry.first]; i != NO_LOCATION; i = next[i])
+            members.push_back(locations[i]);
+        std::reverse(members.begin() + 1, members.end());
+
+        candidates.insert(std::make_pair(SeenTokens(first.get_file_id(),
+                        first.get_begin_token_offset()), std::move(members)));
+    }
+
+    std::vector<Entry>().swap(table);
+    std::vector<CloneLocation>().swap(locations);
+    std::vector<location_index_type>().swap(next);
+    nentries = nclones = 0;
+}
@@ -0,0 +1,101 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A hash table index of clone candidates
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "CandidateIndex.h"
+#include "WindowHasher.h"
+
+/*
+ * An open-addressing hash table keyed by window fingerprints.
+ * Windows with equal fingerprints are compared token by token,
+ * so fingerprint collisions never merge different windows.
+ */
+class HashIndex : public CandidateIndex {
+public:
+    typedef std::uint32_t location_index_type;
+
+    // A table slot; a zero count marks an empty one
+    struct Entry {
+        WindowHasher::fingerprint_type fingerprint;
+        // Index of the window's first location
+        location_index_type first;
+        // Number of the window's locations
+        std::uint32_t count;
+    };
+
+private:
+    const TokenContainer &token_container;
+
+    // Length of the indexed windows
+    unsigned clone_length;
+
+    WindowHasher hasher;
+
+    // Comparison of windows of the indexed length
+    WindowCompare window_compare;
+
+    // Table slots; their number is a power of two
+    std::vector<Entry> table;
+
+    // Number of occupied slots
+    std::size_t nentries = 0;
+
+    // Number of locations of windows seen more than once
+    std::size_t nclones = 0;
+
+    /*
+     * Locations of all windows, and the index of each location's
+     * successor in its window's list.  New locations are linked right
+     * after the window's first one.
+     */
+    std::vector<CloneLocation> locations;
+    std::vector<location_index_type> next;
+
+    // Return true if the windows at the two locations have equal tokens
+    bool same_tokens(const CloneLocation &a, const CloneLocation &b) const;
+
+    // Double the table's size
+    void grow();
+
+public:
+    HashIndex(const TokenContainer &tc, unsigned clone_length);
+
+    // Add the window at the specified location with the given fingerprint
+    void insert(WindowHasher::fingerprint_type fingerprint,
+            const CloneLocation &location);
+
+    void index_file(const FileData &file) override;
+
+    void set_sketch(const WindowSketch *sketch) override {
+        hasher.set_sketch(sketch);
+    }
+
+    void set_shard(const WindowShard &shard) override {
+        hasher.set_shard(shard);
+    }
+
+    std::size_t size() override { return nentries; }
+
+    std::size_t number_of_clones() override { return nclones; }
+
+    void move_clones(CloneDetector::candidates_type &candidates) override;
+};
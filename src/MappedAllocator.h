@@ -0,0 +1,97 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * An allocator of memory optionally backed by temporary files
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <system_error>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "TemporaryFile.h"
+
+/*
+ * An allocator that normally allocates from the heap, but when
+ * constructed as file-backed maps its allocations from temporary
+ * files.  The operating system can then write their pages back to the
+ * files and reuse the memory, rather than keeping them resident or
+ * pushing them to a (possibly absent) swap area.
+ * Containers adopt the allocator with which they are assigned.
+ */
+template <typename T>
+class MappedAllocator {
+private:
+    bool file_backed;
+
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    MappedAllocator(bool file_backed = false) noexcept :
+        file_backed(file_backed) {}
+
+    template <typename U>
+    MappedAllocator(const MappedAllocator<U> &other) noexcept :
+        file_backed(other.is_file_backed()) {}
+
+    bool is_file_backed() const { return file_backed; }
+
+    T *allocate(std::size_t n) {
+        if (!file_backed || n == 0)
+            return std::allocator<T>().allocate(n);
+
+        std::size_t size = n * sizeof(T);
+        int fd = create_temporary_file();
+        if (ftruncate(fd, size) == -1) {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(),
+                    "Error sizing temporary file");
+        }
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+        int error = errno;
+        // The mapping keeps the file alive
+        close(fd);
+        if (p == MAP_FAILED)
+            throw std::system_error(error, std::generic_category(),
+                    "Error mapping temporary file");
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) {
+        if (!file_backed || n == 0)
+            std::allocator<T>().deallocate(p, n);
+        else
+            munmap(p, n * sizeof(T));
+    }
+
+    friend bool operator==(const MappedAllocator &a, const MappedAllocator &b) {
+        return a.file_backed == b.file_backed;
+    }
+
+    friend bool operator!=(const MappedAllocator &a, const MappedAllocator &b) {
+        return a.file_backed != b.file_backed;
+    }
+};
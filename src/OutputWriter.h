@@ -0,0 +1,168 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A buffered writer of report output
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <unistd.h>
+
+/*
+ * A writer that collects output in a large buffer, which it writes
+ * to a file descriptor or stream only when it fills up, and formats
+ * numbers without the overhead of iostreams.
+ * The buffer is flushed when the writer is destroyed.
+ */
+class OutputWriter {
+private:
+    // Bytes collected before they are written
+    static const std::size_t BUFFER_SIZE = 1024 * 1024;
+
+    std::unique_ptr<char[]> buffer;
+    std::size_t used = 0;
+
+    // Destination: the stream, if set, or the file descriptor
+    int fd = -1;
+    std::ostream *stream = nullptr;
+
+    // Number of bytes written through the writer
+    std::size_t nbytes = 0;
+
+    // Write n bytes from s to the destination
+    void write_out(const char *s, std::size_t n) {
+        nbytes += n;
+        if (stream) {
+            stream->write(s, n);
+            return;
+        }
+        while (n > 0) {
+            ssize_t written = write(fd, s, n);
+            if (written == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(),
+                        "Error writing output");
+            }
+            s += written;
+            n -= written;
+        }
+    }
+
+    // Make room for at least n bytes in the buffer
+    void reserve(std::size_t n) {
+        if (used + n > BUFFER_SIZE)
+            flush();
+    }
+
+public:
+    // Write to the specified file descriptor
+    OutputWriter(int fd) : buffer(new char[BUFFER_SIZE]), fd(fd) {}
+
+    // Write to the specified stream
+    OutputWriter(std::ostream &stream) :
+        buffer(new char[BUFFER_SIZE]), stream(&stream) {}
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    ~OutputWriter() {
+        try {
+            flush();
+        } catch (const std::system_error &) {
+            // Call flush() explicitly to handle errors
+        }
+    }
+
+    // Write the buffered output
+    void flush() {
+        std::size_t n = used;
+        used = 0;
+        write_out(buffer.get(), n);
+    }
+
+    // Return the number of bytes written through the writer
+    std::size_t size() const { return nbytes + used; }
+
+    OutputWriter &write_bytes(const char *s, std::size_t n) {
+        reserve(n);
+        if (n > BUFFER_SIZE)
+            write_out(s, n);
+        else {
+            std::memcpy(buffer.get() + used, s, n);
+            used += n;
+        }
+        return *this;
+    }
+
+    OutputWriter &operator<<(char c) {
+        reserve(1);
+        buffer[used++] = c;
+        return *this;
+    }
+
+    OutputWriter &operator<<(const char *s) {
+        return write_bytes(s, std::strlen(s));
+    }
+
+    OutputWriter &operator<<(const std::string &s) {
+        return write_bytes(s.data(), s.size());
+    }
+
+    // Write an unsigned integer in decimal
+    template <typename T>
+    typename std::enable_if<std::is_unsigned<T>::value, OutputWriter &>::type
+    operator<<(T value) {
+        char digits[20];
+        char *p = digits + sizeof(digits);
+        do {
+            *--p = char('0' + value % 10);
+            value /= 10;
+        } while (value);
+        return write_bytes(p, digits + sizeof(digits) - p);
+    }
+
+    // Write an unsigned LEB128 variable-length integer
+    OutputWriter &write_varint(std::uint64_t v) {
+        reserve(10);
+        while (v >= 0x80) {
+            buffer[used++] = char(v | 0x80);
+            v >>= 7;
+        }
+        buffer[used++] = char(v);
+        return *this;
+    }
+
+    // Write a string as the contents of a JSON string
+    OutputWriter &write_json_string(const std::string &s) {
+        for (char c : s) {
+            reserve(2);
+            if (c == '"' || c == '\\')
+                buffer[used++] = '\\';
+            buffer[used++] = c;
+        }
+        return *this;
+    }
+};
@@ -0,0 +1,69 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * Simple parallel execution of independent tasks
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Call fn(i) for each i in [0, n) using up to nthreads threads,
+ * including the calling one.
+ * Indices are handed out one at a time, so threads finishing their
+ * tasks early take on the remaining work of others.
+ * If a call throws, no further indices are handed out, and the first
+ * exception thrown is rethrown once all threads have finished.
+ */
+template <typename F>
+void
+parallel_for(unsigned nthreads, std::size_t n, F fn)
+{
+    if (nthreads <= 1 || n <= 1) {
+        for (std::size_t i = 0; i < n; i++)
+            fn(i);
+        return;
+    }
+
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        try {
+            for (std::size_t i; (i = next++) < n; )
+                fn(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+            next = n;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < nthreads && t < n; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+        t.join();
+    if (error)
+        std::rethrow_exception(error);
+}
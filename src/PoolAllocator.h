@@ -0,0 +1,150 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * An allocator of container nodes from large memory blocks
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/*
+ * A pool of equally-sized objects, which are carved out of large
+ * blocks and recycled through a free list when deallocated.
+ * The size is set by the first allocation; objects of other sizes
+ * are not served.
+ * All its memory is freed at once when the pool is destroyed.
+ * It is not thread-safe.
+ */
+class NodePool {
+private:
+    // Bytes in each block
+    static const std::size_t BLOCK_SIZE = 1024 * 1024;
+
+    // A deallocated object
+    struct FreeNode {
+        FreeNode *next;
+    };
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+
+    // Unused part of the last block
+    char *block_next = nullptr;
+    char *block_end = nullptr;
+
+    FreeNode *free_list = nullptr;
+
+    // Size of the allocated objects; 0 before the first allocation
+    std::size_t object_size = 0;
+
+    // Return the size of an object, rounded up to keep objects aligned
+    static std::size_t rounded(std::size_t size) {
+        const std::size_t align = alignof(std::max_align_t);
+        size = std::max(size, sizeof(FreeNode));
+        return (size + align - 1) / align * align;
+    }
+
+public:
+    // Return true if objects of the specified size are allocated here
+    bool serves(std::size_t size) {
+        if (object_size == 0)
+            object_size = rounded(size);
+        return rounded(size) == object_size;
+    }
+
+    // Allocate an object of the served size
+    void *allocate() {
+        if (free_list) {
+            void *p = free_list;
+            free_list = free_list->next;
+            return p;
+        }
+        if (block_next == block_end) {
+            blocks.emplace_back(new char[BLOCK_SIZE]);
+            block_next = blocks.back().get();
+            block_end = block_next + BLOCK_SIZE / object_size * object_size;
+        }
+        void *p = block_next;
+        block_next += object_size;
+        return p;
+    }
+
+    void deallocate(void *p) {
+        FreeNode *n = static_cast<FreeNode *>(p);
+        n->next = free_list;
+        free_list = n;
+    }
+};
+
+/*
+ * An allocator for node-based containers, which allocates their
+ * nodes from a pool shared among its copies.
+ * This avoids the time and space overhead of allocating each node
+ * on the heap, and frees all nodes at once with the last copy.
+ * Other allocations are served from the heap.
+ */
+template <typename T>
+class PoolAllocator {
+private:
+    std::shared_ptr<NodePool> pool;
+
+    template <typename U> friend class PoolAllocator;
+
+    // Return true if n objects are allocated from the pool
+    bool pooled(std::size_t n) const {
+        return n == 1 && pool->serves(sizeof(T));
+    }
+
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    PoolAllocator() : pool(std::make_shared<NodePool>()) {}
+
+    // Copies, which also serve for moves, share the pool
+    PoolAllocator(const PoolAllocator &other) noexcept :
+        pool(other.pool) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &other) noexcept :
+        pool(other.pool) {}
+
+    T *allocate(std::size_t n) {
+        if (pooled(n))
+            return static_cast<T *>(pool->allocate());
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, std::size_t n) {
+        if (pooled(n))
+            pool->deallocate(p);
+        else
+            std::allocator<T>().deallocate(p, n);
+    }
+
+    friend bool operator==(const PoolAllocator &a, const PoolAllocator &b) {
+        return a.pool == b.pool;
+    }
+
+    friend bool operator!=(const PoolAllocator &a, const PoolAllocator &b) {
+        return a.pool != b.pool;
+    }
+};
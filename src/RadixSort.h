@@ -0,0 +1,99 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * Parallel radix sort of records by a 64-bit key
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Parallel.h"
+
+/*
+ * Sort the specified records in ascending order of the 64-bit value
+ * returned by key(record), using up to nthreads threads.
+ * This is a least significant digit radix sort, so it is stable:
+ * records with equal keys retain their relative order.
+ * Each pass splits the records into one contiguous chunk per thread;
+ * the threads count their chunk's digits, and then scatter the chunk
+ * into positions derived from the counts in digit and chunk order.
+ */
+template <typename T, typename Key>
+void
+radix_sort(std::vector<T> &records, unsigned nthreads, Key key)
+{
+    const unsigned DIGIT_BITS = 11;
+    const std::size_t NBUCKETS = 1 << DIGIT_BITS;
+    const std::size_t n = records.size();
+
+    if (n < 2)
+        return;
+    if (nthreads < 1)
+        nthreads = 1;
+    std::size_t nchunks = std::min<std::size_t>(nthreads, n);
+    std::size_t chunk_size = (n + nchunks - 1) / nchunks;
+
+    std::vector<T> buffer(n);
+    std::vector<std::vector<std::size_t>> position(nchunks,
+            std::vector<std::size_t>(NBUCKETS));
+    std::vector<T> *from = &records, *to = &buffer;
+
+    for (unsigned shift = 0; shift < 64; shift += DIGIT_BITS) {
+        auto digit = [&](const T &r) {
+            return (key(r) >> shift) & (NBUCKETS - 1);
+        };
+
+        // Count each chunk's digits
+        parallel_for(nthreads, nchunks, [&](std::size_t c) {
+            auto& count = position[c];
+            std::fill(count.begin(), count.end(), 0);
+            std::size_t end = std::min(n, (c + 1) * chunk_size);
+            for (std::size_t i = c * chunk_size; i < end; i++)
+                count[digit((*from)[i])]++;
+        });
+
+        // Skip passes over digits that are the same in all records
+        std::size_t first_digit = digit((*from)[0]);
+        std::size_t same = 0;
+        for (std::size_t c = 0; c < nchunks; c++)
+            same += position[c][first_digit];
+        if (same == n)
+            continue;
+
+        // Convert counts into starting positions
+        std::size_t sum = 0;
+        for (std::size_t d = 0; d < NBUCKETS; d++)
+            for (std::size_t c = 0; c < nchunks; c++) {
+                std::size_t count = position[c][d];
+                position[c][d] = sum;
+                sum += count;
+            }
+
+        // Scatter the chunks
+        parallel_for(nthreads, nchunks, [&](std::size_t c) {
+            auto& pos = position[c];
+            std::size_t end = std::min(n, (c + 1) * chunk_size);
+            for (std::size_t i = c * chunk_size; i < end; i++)
+                (*to)[pos[digit((*from)[i])]++] = (*from)[i];
+        });
+        std::swap(from, to);
+    }
+
+    if (from != &records)
+        records.swap(buffer);
+}
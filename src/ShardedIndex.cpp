@@ -0,0 +1,147 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A hash index of clone candidates built by multiple threads
+ */
+
+#include <algorithm>
+
+#include "Parallel.h"
+#include "ShardedIndex.h"
+
+ShardedIndex::ShardedIndex(const TokenContainer &tc, unsigned clone_length,
+        unsigned nthreads) :
+    token_container(tc), clone_length(clone_length), nthreads(nthreads),
+    shard_bits(1)
+{
+    // Use several shards per thread to balance their load
+    while ((1U << shard_bits) < 4 * nthreads)
+        shard_bits++;
+    for (unsigned i = 0; i < (1U << shard_bits); i++)
+        shards.emplace_back(new HashIndex(tc, clone_length));
+}
+
+/*
+ * Index the recorded files into the shards.
+ * First, each task computes the fingerprints of a contiguous range
+ * of files, and distributes them into one bucket per shard.
+ * Then, each shard inserts its buckets' windows in task order,
+ * so that its locations retain the indexing order.
+ */
+void
+ShardedIndex::build()
+{
+    if (built)
+        return;
+    built = true;
+
+    struct Window {
+        WindowHasher::fingerprint_type fingerprint;
+        CloneLocation location;
+    };
+
+    const std::size_t nshards = shards.size();
+    const std::size_t ntasks = std::min<std::size_t>(file_ids.size(),
+            4 * nthreads);
+    std::vector<std::vector<std::vector<Window>>> buckets(ntasks,
+            std::vector<std::vector<Window>>(nshards));
+
+    parallel_for(nthreads, ntasks, [&](std::size_t task) {
+        WindowHasher hasher(clone_length);
+        hasher.set_sketch(sketch);
+        hasher.set_shard(window_shard);
+        auto& task_buckets = buckets[task];
+        std::size_t end = file_ids.size() * (task + 1) / ntasks;
+        for (std::size_t f = file_ids.size() * task / ntasks; f < end; f++) {
+            const FileData &file = token_container.get_file(file_ids[f]);
+            hasher.for_each_window(file, [&](FileData::token_offset_type offset,
+                        WindowHasher::fingerprint_type fingerprint) {
+                task_buckets[fingerprint >> (64 - shard_bits)].push_back(
+                        Window{fingerprint, CloneLocation(file.get_id(), offset)});
+            });
+        }
+    });
+
+    parallel_for(nthreads, nshards, [&](std::size_t shard) {
+        for (auto& task_buckets : buckets) {
+            for (const auto& window : task_buckets[shard])
+                shards[shard]->insert(window.fingerprint, window.location);
+            std::vector<Window>().swap(task_buckets[shard]);
+        }
+    });
+
+    std::vector<CloneLocation::file_id_type>().swap(file_ids);
+}
+
+std::size_t
+ShardedIndex::size()
+{
+    build();
+    std::size_t n = 0;
+    for (auto& shard : shards)
+        n += shard->size();
+    return n;
+}
+
+std::size_t
+ShardedIndex::number_of_clones()
+{
+    build();
+    std::size_t n = 0;
+    for (auto& shard : shards)
+        n += shard->number_of_clones();
+    return n;
+}
+
+/*
+ * Move the windows seen more than once into the specified map,
+ * with their locations in indexing order, and free the index.
+ * Each shard's windows are first ordered in a separate map by their
+ * own thread; the maps are then merged in order, so that each
+ * insertion into the specified map takes constant time.
+ */
+void
+ShardedIndex::move_clones(CloneDetector::candidates_type &candidates)
+{
+    build();
+
+    std::vector<CloneDetector::candidates_type> shard_candidates(shards.size());
+    parallel_for(nthreads, shards.size(), [&](std::size_t shard) {
+        shards[shard]->move_clones(shard_candidates[shard]);
+        shards[shard].reset();
+    });
+
+    typedef CloneDetector::candidates_type::iterator iterator;
+    typedef std::pair<iterator, iterator> range;
+    // Heap ordering that places the smallest first window at the top
+    auto greater = [](const range &a, const range &b) {
+        return b.first->first < a.first->first;
+    };
+
+    std::vector<range> heads;
+    for (auto& sc : shard_candidates)
+        if (!sc.empty())
+            heads.push_back(range(sc.begin(), sc.end()));
+    std::make_heap(heads.begin(), heads.end(), greater);
+    while (!heads.empty()) {
+        std::pop_heap(heads.begin(), heads.end(), greater);
+        range &head = heads.back();
+        candidates.emplace_hint(candidates.end(), std::move(*head.first));
+        if (++head.first == head.second)
+            heads.pop_back();
+        else
+            std::push_heap(heads.begin(), heads.end(), greater);
+    }
+}
@@ -0,0 +1,82 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A hash index of clone candidates built by multiple threads
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "CandidateIndex.h"
+#include "HashIndex.h"
+
+/*
+ * A set of hash indices (shards), each holding the windows whose
+ * fingerprints have a given prefix.
+ * Windows with equal tokens have equal fingerprints, so each shard
+ * can be built and pruned by a separate thread without any locking.
+ * Indexed files are only recorded; the shards are built once all
+ * files have been indexed.
+ */
+class ShardedIndex : public CandidateIndex {
+private:
+    const TokenContainer &token_container;
+
+    // Length of the indexed windows
+    unsigned clone_length;
+
+    // Number of threads used for building the shards
+    unsigned nthreads;
+
+    // Number of fingerprint prefix bits selecting a shard
+    unsigned shard_bits;
+
+    std::vector<std::unique_ptr<HashIndex>> shards;
+
+    // Ids of the files to index
+    std::vector<CloneLocation::file_id_type> file_ids;
+
+    // True once the shards have been built
+    bool built = false;
+
+    // When set, only windows it reports as repeated are indexed
+    const WindowSketch *sketch = nullptr;
+
+    // Only windows in this shard are indexed
+    WindowShard window_shard;
+
+    // Index the recorded files into the shards
+    void build();
+
+public:
+    ShardedIndex(const TokenContainer &tc, unsigned clone_length,
+            unsigned nthreads);
+
+    void index_file(const FileData &file) override {
+        file_ids.push_back(file.get_id());
+    }
+
+    void set_sketch(const WindowSketch *s) override { sketch = s; }
+
+    void set_shard(const WindowShard &s) override { window_shard = s; }
+
+    std::size_t size() override;
+
+    std::size_t number_of_clones() override;
+
+    void move_clones(CloneDetector::candidates_type &candidates) override;
+};
@@ -0,0 +1,156 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A vector storing a few elements inline
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <type_traits>
+
+/*
+ * A vector of plain values that stores up to N elements inline,
+ * and moves them to the heap only when it grows beyond them.
+ * It takes up the same space as a std::vector, but avoids an
+ * allocation for the common case of few elements.
+ */
+template <typename T, unsigned N>
+class SmallVector {
+    static_assert(std::is_trivially_copyable<T>::value,
+            "Elements are copied as plain memory");
+
+public:
+    typedef T value_type;
+    typedef std::uint32_t size_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+private:
+    size_type nelements = 0;
+    size_type capacity = N;
+
+    // The elements, or a pointer to them when they exceed N
+    union {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type local[N];
+        T *heap;
+    };
+
+    // Set the capacity to n > N elements
+    void grow(size_type n) {
+        T *p = static_cast<T *>(::operator new(n * sizeof(T)));
+        std::copy(begin(), end(), p);
+        release();
+        heap = p;
+        capacity = n;
+    }
+
+    // Free the heap storage, if any
+    void release() {
+        if (!is_inline())
+            ::operator delete(heap);
+    }
+
+    // Take over the contents of other, leaving it empty
+    void take(SmallVector &other) noexcept {
+        nelements = other.nelements;
+        capacity = other.capacity;
+        if (other.is_inline())
+            std::copy(other.local, other.local + nelements, local);
+        else
+            heap = other.heap;
+        other.nelements = 0;
+        other.capacity = N;
+    }
+
+public:
+    SmallVector() {}
+
+    SmallVector(std::initializer_list<T> elements) :
+        SmallVector(elements.begin(), elements.end()) {}
+
+    template <typename ForwardIterator>
+    SmallVector(ForwardIterator first, ForwardIterator last) {
+        reserve(std::distance(first, last));
+        nelements = std::copy(first, last, begin()) - begin();
+    }
+
+    SmallVector(const SmallVector &other) :
+        SmallVector(other.begin(), other.end()) {}
+
+    SmallVector(SmallVector &&other) noexcept {
+        take(other);
+    }
+
+    SmallVector &operator=(const SmallVector &other) {
+        if (this != &other) {
+            nelements = 0;
+            reserve(other.size());
+            nelements = std::copy(other.begin(), other.end(), begin()) - begin();
+        }
+        return *this;
+    }
+
+    SmallVector &operator=(SmallVector &&other) noexcept {
+        if (this != &other) {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+    ~SmallVector() {
+        release();
+    }
+
+    // Return true if the elements are stored inline
+    bool is_inline() const { return capacity == N; }
+
+    size_type size() const { return nelements; }
+    bool empty() const { return nelements == 0; }
+
+    iterator begin() {
+        return is_inline() ? reinterpret_cast<T *>(local) : heap;
+    }
+    iterator end() { return begin() + nelements; }
+    const_iterator begin() const {
+        return is_inline() ? reinterpret_cast<const T *>(local) : heap;
+    }
+    const_iterator end() const { return begin() + nelements; }
+
+    T &operator[](size_type i) { return begin()[i]; }
+    const T &operator[](size_type i) const { return begin()[i]; }
+    T &front() { return *begin(); }
+    const T &front() const { return *begin(); }
+
+    // Ensure there is space for n elements
+    void reserve(std::size_t n) {
+        if (n > capacity)
+            grow(size_type(n));
+    }
+
+    void push_back(const T &value) {
+        // The value may be one of the elements moved when growing
+        T copy(value);
+        if (nelements == capacity)
+            grow(2 * capacity);
+        begin()[nelements++] = copy;
+    }
+};
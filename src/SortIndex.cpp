@@ -0,0 +1,143 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A sorted array index of clone candidates
+ */
+
+#include <algorithm>
+
+#include "RadixSort.h"
+#include "SortIndex.h"
+
+SortIndex::SortIndex(const TokenContainer &tc, unsigned clone_length,
+        unsigned nthreads) :
+    token_container(tc), clone_length(clone_length), nthreads(nthreads),
+    hasher(clone_length), window_compare(clone_length)
+{
+}
+
+// Return true if the windows of the two records have equal tokens
+bool
+SortIndex::same_tokens(const Record &a, const Record &b) const
+{
+    auto a_begin = token_container.offset_begin(a.file_id, a.offset);
+    auto b_begin = token_container.offset_begin(b.file_id, b.offset);
+    return window_compare.equal(a_begin, b_begin);
+}
+
+void
+SortIndex::index_file(const FileData &file)
+{
+    hasher.for_each_window(file, [&](FileData::token_offset_type offset,
+                WindowHasher::fingerprint_type fingerprint) {
+        insert(fingerprint, CloneLocation(file.get_id(), offset));
+    });
+}
+
+/*
+ * Sort the records and keep only groups of equal windows.
+ * The sort is stable, so records with the same fingerprint retain
+ * their indexing order.  Each run of equal fingerprints normally
+ * holds a single window; records of any colliding windows in it are
+ * split into separate groups.
+ */
+void
+SortIndex::group()
+{
+    if (grouped)
+        return;
+    grouped = true;
+
+    radix_sort(records, nthreads, [](const Record &r) {
+        return r.fingerprint;
+    });
+
+    std::size_t out = 0;        // Output position of kept records
+    std::vector<Record> run;    // Records of a run with collisions
+    std::vector<std::size_t> run_begin;
+    for (std::size_t begin = 0, end; begin < records.size(); begin = end) {
+        // Find the run of equal fingerprints
+        for (end = begin + 1; end < records.size()
+                && records[end].fingerprint == records[begin].fingerprint;
+                end++)
+            ;
+
+        if (end - begin == 1) {
+            nwindows++;
+            continue;
+        }
+
+        std::size_t i = begin + 1;
+        for (; i < end; i++)
+            if (!same_tokens(records[begin], records[i]))
+                break;
+        if (i == end) {
+            // A single window; the common case
+            nwindows++;
+            group_begin.push_back(out);
+            for (i = begin; i < end; i++)
+                records[out++] = records[i];
+            continue;
+        }
+
+        // Fingerprint collision: group the run's records by their tokens
+        run.assign(records.begin() + begin, records.begin() + end);
+        std::vector<bool> taken(run.size());
+        for (std::size_t leader = 0; leader < run.size(); leader++) {
+            if (taken[leader])
+                continue;
+            nwindows++;
+            run_begin.clear();
+            for (std::size_t j = leader; j < run.size(); j++)
+                if (!taken[j] && (j == leader
+                            || same_tokens(run[leader], run[j]))) {
+                    taken[j] = true;
+                    run_begin.push_back(j);
+                }
+            if (run_begin.size() == 1)
+                continue;
+            group_begin.push_back(out);
+            for (auto j : run_begin)
+                records[out++] = run[j];
+        }
+    }
+    group_begin.push_back(out);
+    records.resize(out);
+    records.shrink_to_fit();
+}
+
+/*
+ * Move the windows seen more than once into the specified map,
+ * with their locations in indexing order, and free the index.
+ */
+void
+SortIndex::move_clones(CloneDetector::candidates_type &candidates)
+{
+    group();
+
+    for (std::size_t g = 0; g + 1 < group_begin.size(); g++) {
+        CloneDetector::seen_locations_type members;
+        members.reserve(group_begin[g + 1] - group_begin[g]);
+        for (std::size_t i = group_begin[g]; i < group_begin[g + 1]; i++)
+            members.push_back(records[i].location());
+
+        const CloneLocation &first = members.front();
+        candidates.insert(std::make_pair(SeenTokens(first.get_file_id(),
+                        first.get_begin_token_offset()), std::move(members)));
+    }
+
+    std::vector<Record>().swap(records);
+    std::vector<std::size_t>().swap(group_begin);
+}
@@ -0,0 +1,115 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A sorted array index of clone candidates
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "CandidateIndex.h"
+#include "WindowHasher.h"
+
+/*
+ * A flat array of (fingerprint, location) records, one per window.
+ * Once all files have been indexed, the array is radix-sorted, and
+ * runs of equal fingerprints are split into groups of windows with
+ * equal tokens.  Windows seen only once are then dropped in a single
+ * linear pass.
+ */
+class SortIndex : public CandidateIndex {
+public:
+    // A window's fingerprint and location
+    struct Record {
+        WindowHasher::fingerprint_type fingerprint;
+        CloneLocation::file_id_type file_id;
+        CloneLocation::token_offset_type offset;
+
+        CloneLocation location() const {
+            return CloneLocation(file_id, offset);
+        }
+    };
+
+private:
+    const TokenContainer &token_container;
+
+    // Length of the indexed windows
+    unsigned clone_length;
+
+    // Number of threads used for sorting
+    unsigned nthreads;
+
+    WindowHasher hasher;
+
+    // Comparison of windows of the indexed length
+    WindowCompare window_compare;
+
+    /*
+     * Records of all windows.  After grouping, only the records of
+     * windows seen more than once, with each group stored contiguously.
+     */
+    std::vector<Record> records;
+
+    // Index in records of each group's first record, plus the end
+    std::vector<std::size_t> group_begin;
+
+    // True once records have been grouped
+    bool grouped = false;
+
+    // Number of distinct windows
+    std::size_t nwindows = 0;
+
+    // Return true if the windows of the two records have equal tokens
+    bool same_tokens(const Record &a, const Record &b) const;
+
+    // Sort the records and keep only groups of equal windows
+    void group();
+
+public:
+    SortIndex(const TokenContainer &tc, unsigned clone_length,
+            unsigned nthreads);
+
+    // Add the window at the specified location with the given fingerprint
+    void insert(WindowHasher::fingerprint_type fingerprint,
+            const CloneLocation &location) {
+        records.push_back(Record{fingerprint,
+                CloneLocation::file_id_type(location.get_file_id()),
+                CloneLocation::token_offset_type(location.get_begin_token_offset())});
+    }
+
+    void index_file(const FileData &file) override;
+
+    void set_sketch(const WindowSketch *sketch) override {
+        hasher.set_sketch(sketch);
+    }
+
+    void set_shard(const WindowShard &shard) override {
+        hasher.set_shard(shard);
+    }
+
+    std::size_t size() override {
+        group();
+        return nwindows;
+    }
+
+    std::size_t number_of_clones() override {
+        group();
+        return records.size();
+    }
+
+    void move_clones(CloneDetector::candidates_type &candidates) override;
+};
@@ -0,0 +1,330 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * An index of clone candidates kept in sorted runs on disk
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <queue>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "Parallel.h"
+#include "SpillIndex.h"
+#include "TemporaryFile.h"
+#include "TokenCompare.h"
+
+// Number of a window's leading tokens packed into its record's key
+static const unsigned KEY_TOKENS = 2;
+
+// Return a key ordering windows as their first two tokens do
+static std::uint64_t
+window_key(FileData::tokens_type::const_iterator tokens, unsigned length)
+{
+    std::uint64_t key = std::uint64_t(tokens[0]) << 32;
+    if (length > 1)
+        key |= tokens[1];
+    return key;
+}
+
+// A buffered reader of a run's records
+class RunReader {
+private:
+    int fd;
+    std::size_t pos, end;       // Next record to read and run end
+    std::vector<SpillIndex::Record> buffer;
+    std::size_t next = 0;       // Next record in the buffer
+
+    // Read the next block of records into the buffer
+    void fill() {
+        std::size_t n = std::min(buffer.capacity(), end - pos);
+        buffer.resize(n);
+        char *p = reinterpret_cast<char *>(buffer.data());
+        std::size_t nbytes = n * sizeof(SpillIndex::Record);
+        off_t offset = pos * sizeof(SpillIndex::Record);
+        while (nbytes > 0) {
+            ssize_t nread = pread(fd, p, nbytes, offset);
+            if (nread <= 0)
+                throw std::system_error(nread ? errno : EIO,
+                        std::generic_category(),
+                        "Error reading temporary file");
+            p += nread;
+            nbytes -= nread;
+            offset += nread;
+        }
+        pos += n;
+        next = 0;
+    }
+
+public:
+    RunReader(int fd, std::size_t begin, std::size_t end,
+            std::size_t buffer_size) :
+        fd(fd), pos(begin), end(end) {
+        buffer.reserve(buffer_size);
+        fill();
+    }
+
+    const SpillIndex::Record &front() const { return buffer[next]; }
+
+    // Advance to the next record; return false at the run's end
+    bool pop() {
+        if (++next < buffer.size())
+            return true;
+        if (pos == end)
+            return false;
+        fill();
+        return true;
+    }
+};
+
+SpillIndex::SpillIndex(const TokenContainer &tc, unsigned clone_length,
+        unsigned nthreads, std::size_t memory_limit) :
+    token_container(tc), clone_length(clone_length), nthreads(nthreads),
+    memory_limit(memory_limit), hasher(clone_length)
+{
+    // Half of the budget buffers records; the rest serves merging
+    buffer_capacity = std::max<std::size_t>(memory_limit / 2 / sizeof(Record),
+            16);
+    buffer.reserve(buffer_capacity);
+}
+
+SpillIndex::~SpillIndex()
+{
+    if (fd != -1)
+        close(fd);
+}
+
+// Return true if the two records have windows with equal tokens
+bool
+SpillIndex::same_tokens(const Record &a, const Record &b) const
+{
+    if (a.key != b.key)
+        return false;
+    if (clone_length <= KEY_TOKENS)
+        return true;
+    auto a_begin = token_container.offset_begin(a.file_id, a.offset);
+    auto b_begin = token_container.offset_begin(b.file_id, b.offset);
+    return tokens_equal(a_begin + KEY_TOKENS, b_begin + KEY_TOKENS,
+            clone_length - KEY_TOKENS);
+}
+
+/*
+ * Return true if a's window orders before b's.  Windows order as
+ * their tokens do, and equal ones as their locations do.
+ */
+bool
+SpillIndex::less(const Record &a, const Record &b) const
+{
+    if (a.key != b.key)
+        return a.key < b.key;
+    if (clone_length > KEY_TOKENS) {
+        auto a_begin = token_container.offset_begin(a.file_id, a.offset);
+        auto b_begin = token_container.offset_begin(b.file_id, b.offset);
+        int order = token_compare(a_begin + KEY_TOKENS, b_begin + KEY_TOKENS,
+                clone_length - KEY_TOKENS);
+        if (order)
+            return order < 0;
+    }
+    if (a.file_id != b.file_id)
+        return a.file_id < b.file_id;
+    return a.offset < b.offset;
+}
+
+void
+SpillIndex::index_file(const FileData &file)
+{
+    CloneLocation::file_id_type file_id = file.get_id();
+    hasher.for_each_window(file, [&](FileData::token_offset_type offset,
+                WindowHasher::fingerprint_type) {
+        buffer.push_back(Record{window_key(file.offset_begin(offset),
+                    clone_length), file_id,
+                CloneLocation::token_offset_type(offset)});
+        if (buffer.size() == buffer_capacity)
+            spill();
+    });
+}
+
+/*
+ * Sort the buffered records and append them to the temporary file.
+ * Each thread sorts a part of the buffer, which becomes a separate run.
+ */
+void
+SpillIndex::spill()
+{
+    if (buffer.empty())
+        return;
+
+    std::size_t nruns = std::min<std::size_t>(nthreads, buffer.size());
+    parallel_for(nthreads, nruns, [&](std::size_t r) {
+        std::sort(buffer.begin() + buffer.size() * r / nruns,
+                buffer.begin() + buffer.size() * (r + 1) / nruns,
+                [this](const Record &a, const Record &b) {
+            return less(a, b);
+        });
+    });
+
+    if (fd == -1)
+        fd = create_temporary_file();
+    const char *p = reinterpret_cast<const char *>(buffer.data());
+    std::size_t nbytes = buffer.size() * sizeof(Record);
+    off_t offset = run_begin.back() * sizeof(Record);
+    while (nbytes > 0) {
+        ssize_t nwritten = pwrite(fd, p, nbytes, offset);
+        if (nwritten == -1)
+            throw std::system_error(errno, std::generic_category(),
+                    "Error writing temporary file");
+        p += nwritten;
+        nbytes -= nwritten;
+        offset += nwritten;
+    }
+
+    std::size_t base = run_begin.back();
+    for (std::size_t r = 1; r <= nruns; r++)
+        run_begin.push_back(base + buffer.size() * r / nruns);
+    buffer.clear();
+}
+
+// Write the remaining records and free the buffer
+void
+SpillIndex::finish()
+{
+    if (finished)
+        return;
+    finished = true;
+    spill();
+    std::vector<Record>().swap(buffer);
+}
+
+/*
+ * Merge the runs, calling fn(group) with the records of each distinct
+ * window, ordered by the windows' tokens.  Each group's records are
+ * ordered by their location, which is their indexing order.
+ */
+template <typename F>
+void
+SpillIndex::merge(F fn)
+{
+    finish();
+
+    std::size_t nruns = run_begin.size() - 1;
+    std::size_t buffer_size = std::max<std::size_t>(
+            memory_limit / 4 / sizeof(Record) / std::max<std::size_t>(nruns, 1),
+            256);
+    std::vector<RunReader> readers;
+    readers.reserve(nruns);
+    for (std::size_t r = 0; r < nruns; r++)
+        if (run_begin[r] != run_begin[r + 1])
+            readers.emplace_back(fd, run_begin[r], run_begin[r + 1],
+                    buffer_size);
+
+    // A heap of readers, with the one having the first record on top
+    auto after = [&](std::size_t a, std::size_t b) {
+        return less(readers[b].front(), readers[a].front());
+    };
+    std::priority_queue<std::size_t, std::vector<std::size_t>,
+        decltype(after)> heap(after);
+    for (std::size_t r = 0; r < readers.size(); r++)
+        heap.push(r);
+
+    std::vector<Record> group;
+    while (!heap.empty()) {
+        std::size_t r = heap.top();
+        heap.pop();
+        const Record &record = readers[r].front();
+        if (!group.empty() && !same_tokens(group.front(), record)) {
+            fn(group);
+            group.clear();
+        }
+        group.push_back(record);
+        if (readers[r].pop())
+            heap.push(r);
+    }
+    if (!group.empty())
+        fn(group);
+}
+
+// Count the windows, groups, and clones
+void
+SpillIndex::count()
+{
+    if (counted)
+        return;
+    counted = true;
+
+    merge([this](const std::vector<Record> &group) {
+        nwindows++;
+        if (group.size() > 1) {
+            ngroups++;
+            nclones += group.size();
+        }
+    });
+}
+
+/*
+ * Move the windows seen more than once into the specified map,
+ * with their locations in indexing order, and free the index.
+ */
+void
+SpillIndex::move_clones(CloneDetector::candidates_type &candidates)
+{
+    move_clone_batches([&](CloneDetector::candidates_type &batch) {
+        for (auto& it : batch)
+            candidates.emplace_hint(candidates.end(), it.first,
+                    std::move(it.second));
+    });
+}
+
+/*
+ * Call fn(candidates) with successive batches of the windows seen
+ * more than once, in the order of their tokens, and free the index.
+ * Each batch takes up about a quarter of the memory budget.
+ */
+void
+SpillIndex::move_clone_batches(const batch_callback_type &fn)
+{
+    // Approximate size of a map node holding an empty location vector
+    const std::size_t node_size = 4 * sizeof(void *)
+        + sizeof(CloneDetector::candidates_type::value_type);
+
+    CloneDetector::candidates_type batch;
+    std::size_t batch_size = 0;
+    merge([&](const std::vector<Record> &group) {
+        if (group.size() == 1)
+            return;
+
+        CloneDetector::seen_locations_type members;
+        members.reserve(group.size());
+        for (const auto& record : group)
+            members.push_back(CloneLocation(record.file_id, record.offset));
+        batch.emplace_hint(batch.end(), SeenTokens(group.front().file_id,
+                    group.front().offset), std::move(members));
+
+        batch_size += node_size + group.size() * sizeof(CloneLocation);
+        if (batch_size >= memory_limit / 4) {
+            fn(batch);
+            batch.clear();
+            batch_size = 0;
+        }
+    });
+    if (!batch.empty())
+        fn(batch);
+
+    if (fd != -1)
+        close(fd);
+    fd = -1;
+    run_begin.assign(1, 0);
+}
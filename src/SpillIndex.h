@@ -0,0 +1,136 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * An index of clone candidates kept in sorted runs on disk
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CandidateIndex.h"
+#include "WindowHasher.h"
+
+/*
+ * An index that keeps the locations of its windows on disk, so that
+ * its memory use is bounded by a specified budget.
+ * Window locations are collected in a buffer, which, whenever full,
+ * is sorted by the windows' tokens and written to a temporary file
+ * as a run.  The runs are then merged, yielding the locations of
+ * each distinct window together, in the order of the windows' tokens.
+ */
+class SpillIndex : public CandidateIndex {
+public:
+    // A window's location, with its first tokens as a sort key
+    struct Record {
+        std::uint64_t key;
+        CloneLocation::file_id_type file_id;
+        CloneLocation::token_offset_type offset;
+    };
+
+private:
+    const TokenContainer &token_container;
+
+    // Length of the indexed windows
+    unsigned clone_length;
+
+    // Number of threads used for sorting
+    unsigned nthreads;
+
+    // Memory budget in bytes
+    std::size_t memory_limit;
+
+    WindowHasher hasher;
+
+    // Records not yet written to a run
+    std::vector<Record> buffer;
+
+    // Maximum number of records in the buffer
+    std::size_t buffer_capacity;
+
+    // Temporary file holding the runs, or -1
+    int fd = -1;
+
+    // Offset in the file of each run's first record, plus the end
+    std::vector<std::size_t> run_begin{0};
+
+    // True once all records have been written to runs
+    bool finished = false;
+
+    // True once the windows seen only once are to be ignored
+    bool pruned = false;
+
+    // True once the following have been counted
+    bool counted = false;
+    std::size_t nwindows = 0;   // Distinct windows
+    std::size_t ngroups = 0;    // Distinct windows seen more than once
+    std::size_t nclones = 0;    // Locations of the above
+
+    // Return true if a's window orders before b's, or at the same place
+    bool less(const Record &a, const Record &b) const;
+
+    // Return true if the two records have windows with equal tokens
+    bool same_tokens(const Record &a, const Record &b) const;
+
+    // Sort the buffered records and write them as runs
+    void spill();
+
+    // Write the remaining records and finish indexing
+    void finish();
+
+    // Call fn(group) with the records of each distinct window, in order
+    template <typename F>
+    void merge(F fn);
+
+    // Count the windows, groups, and clones
+    void count();
+
+public:
+    SpillIndex(const TokenContainer &tc, unsigned clone_length,
+            unsigned nthreads, std::size_t memory_limit);
+
+    ~SpillIndex();
+
+    void index_file(const FileData &file) override;
+
+    void set_sketch(const WindowSketch *sketch) override {
+        hasher.set_sketch(sketch);
+    }
+
+    void set_shard(const WindowShard &shard) override {
+        hasher.set_shard(shard);
+    }
+
+    std::size_t size() override {
+        count();
+        return pruned ? ngroups : nwindows;
+    }
+
+    std::size_t number_of_clones() override {
+        count();
+        return nclones;
+    }
+
+    bool prune() override {
+        pruned = true;
+        return true;
+    }
+
+    void move_clones(CloneDetector::candidates_type &candidates) override;
+
+    void move_clone_batches(const batch_callback_type &fn) override;
+};
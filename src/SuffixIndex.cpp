@@ -0,0 +1,322 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A suffix array index of clone candidates
+ */
+
+#include <algorithm>
+
+#include "RadixSort.h"
+#include "SuffixIndex.h"
+
+SuffixIndex::SuffixIndex(const TokenContainer &tc, unsigned clone_length,
+        unsigned nthreads) :
+    token_container(tc), clone_length(clone_length), nthreads(nthreads)
+{
+}
+
+void
+SuffixIndex::index_file(const FileData &file)
+{
+    index_type begin = text_size;
+    file_ids.push_back(file.get_id());
+    text_begin.push_back(begin);
+    // Tokens followed by a separator
+    text_size += file.token_size() + 1;
+    window_start.resize(text_size);
+
+    for (const auto& line : file.line_view()) {
+        if (file.line_is_empty(line))
+            continue;
+        if (file.remaining_tokens(line) < clone_length)
+            break;
+        window_start[begin + file.line_offset(line)] = true;
+    }
+}
+
+/*
+ * Return the concatenated text of all indexed files with each token
+ * replaced by its rank among the distinct token values, starting
+ * from 1, and 0 as the file separator.
+ * Set max_rank to the largest rank.
+ */
+SuffixIndex::text_type
+SuffixIndex::ranked_text(index_type &max_rank) const
+{
+    struct TokenPosition {
+        FileData::token_type token;
+        index_type position;
+    };
+
+    std::vector<TokenPosition> tokens;
+    tokens.reserve(text_size - file_ids.size());
+    for (std::size_t f = 0; f < file_ids.size(); f++) {
+        index_type position = text_begin[f];
+        auto end = token_container.file_end(file_ids[f]);
+        for (auto t = token_container.offset_begin(file_ids[f], 0); t != end; ++t)
+            tokens.push_back(TokenPosition{*t, position++});
+    }
+    radix_sort(tokens, nthreads, [](const TokenPosition &t) {
+        return std::uint64_t(t.token);
+    });
+
+    text_type text(text_size, 0);
+    max_rank = 0;
+    for (std::size_t i = 0; i < tokens.size(); i++) {
+        if (i == 0 || tokens[i].token != tokens[i - 1].token)
+            max_rank++;
+        text[tokens[i].position] = max_rank;
+    }
+    return text;
+}
+
+/*
+ * Return the suffix array of text using the SA-IS algorithm
+ * (G. Nong, S. Zhang, and W. H. Chan, Two efficient algorithms for
+ * linear time suffix array construction, IEEE Transactions on
+ * Computers, 60(10), 2011).
+ * Suffixes are classified as S-type (smaller than the following one)
+ * or L-type.  The leftmost S-type (LMS) substrings are sorted by
+ * induction from their buckets; if they are not all distinct, their
+ * order is obtained recursively from the suffix array of their names.
+ * A final induction from the sorted LMS suffixes sorts all suffixes.
+ */
+SuffixIndex::text_type
+SuffixIndex::suffix_array(const text_type &text, index_type max_value)
+{
+    const index_type n = text.size();
+
+    if (n == 0)
+        return text_type();
+    if (n == 1)
+        return text_type{0};
+    if (n == 2)
+        return text[0] < text[1] ? text_type{0, 1} : text_type{1, 0};
+
+    text_type sa(n);
+
+    // True for S-type suffixes; the last one is L-type
+    std::vector<bool> stype(n);
+    for (index_type i = n - 2; i >= 0; i--)
+        stype[i] = text[i] == text[i + 1] ? stype[i + 1]
+            : text[i] < text[i + 1];
+
+    // Start of each value's L-type and S-type suffixes in sa
+    text_type l_begin(max_value + 1), s_begin(max_value + 1);
+    for (index_type i = 0; i < n; i++)
+        if (!stype[i])
+            s_begin[text[i]]++;
+        else if (text[i] < max_value)
+            l_begin[text[i] + 1]++;
+    for (index_type v = 0; v <= max_value; v++) {
+        s_begin[v] += l_begin[v];
+        if (v < max_value)
+            l_begin[v + 1] += s_begin[v];
+    }
+
+    // Sort all suffixes given the order of the LMS ones
+    auto induce = [&](const text_type &lms) {
+        std::fill(sa.begin(), sa.end(), -1);
+        text_type bucket(s_begin);
+        for (auto p : lms)
+            sa[bucket[text[p]]++] = p;
+
+        bucket = l_begin;
+        sa[bucket[text[n - 1]]++] = n - 1;
+        for (index_type i = 0; i < n; i++) {
+            index_type p = sa[i];
+            if (p >= 1 && !stype[p - 1])
+                sa[bucket[text[p - 1]]++] = p - 1;
+        }
+
+        bucket = l_begin;
+        for (index_type i = n - 1; i >= 0; i--) {
+            index_type p = sa[i];
+            if (p >= 1 && stype[p - 1])
+                sa[--bucket[text[p - 1] + 1]] = p - 1;
+        }
+    };
+
+    // Number each LMS position in text order
+    text_type lms_number(n, -1);
+    text_type lms;
+    for (index_type i = 1; i < n; i++)
+        if (!stype[i - 1] && stype[i]) {
+            lms_number[i] = lms.size();
+            lms.push_back(i);
+        }
+    const index_type m = lms.size();
+
+    induce(lms);
+    if (m == 0)
+        return sa;
+
+    // Name the LMS substrings in their sorted order
+    text_type sorted_lms;
+    sorted_lms.reserve(m);
+    for (auto p : sa)
+        if (lms_number[p] != -1)
+            sorted_lms.push_back(p);
+
+    text_type names(m);
+    index_type max_name = 0;
+    names[lms_number[sorted_lms[0]]] = 0;
+    for (index_type i = 1; i < m; i++) {
+        index_type l = sorted_lms[i - 1], r = sorted_lms[i];
+        index_type end_l = lms_number[l] + 1 < m ? lms[lms_number[l] + 1] : n;
+        index_type end_r = lms_number[r] + 1 < m ? lms[lms_number[r] + 1] : n;
+        bool same = end_l - l == end_r - r;
+        if (same) {
+            for (; l < end_l && text[l] == text[r]; l++, r++)
+                ;
+            same = l < n && r < n && text[l] == text[r];
+        }
+        if (!same)
+            max_name++;
+        names[lms_number[sorted_lms[i]]] = max_name;
+    }
+    text_type().swap(lms_number);
+
+    text_type names_sa(suffix_array(names, max_name));
+    for (index_type i = 0; i < m; i++)
+        sorted_lms[i] = lms[names_sa[i]];
+    induce(sorted_lms);
+    return sa;
+}
+
+/*
+ * Return the permuted LCP array using the PHI algorithm
+ * (J. Kärkkäinen, G. Manzini, and S. J. Puglisi, Permuted longest-common-
+ * prefix array, CPM 2009).
+ * The array first holds for each suffix the position of its predecessor
+ * in sa, which is then overwritten with their common prefix length.
+ * Each common prefix is at most one token shorter than the
+ * previous position's, so the total comparison work is linear.
+ */
+SuffixIndex::text_type
+SuffixIndex::plcp_array(const text_type &text, const text_type &sa)
+{
+    const index_type n = text.size();
+    text_type plcp(n);
+
+    if (n == 0)
+        return plcp;
+    plcp[sa[0]] = -1;
+    for (index_type i = 1; i < n; i++)
+        plcp[sa[i]] = sa[i - 1];
+
+    index_type l = 0;
+    for (index_type p = 0; p < n; p++) {
+        index_type previous = plcp[p];
+        if (previous < 0) {
+            plcp[p] = l = 0;
+            continue;
+        }
+        while (p + l < n && previous + l < n
+                && text[p + l] == text[previous + l])
+            l++;
+        plcp[p] = l;
+        if (l > 0)
+            l--;
+    }
+    return plcp;
+}
+
+// Return the location of the specified text position
+CloneLocation
+SuffixIndex::location(index_type position) const
+{
+    auto f = std::upper_bound(text_begin.begin(), text_begin.end(), position)
+        - text_begin.begin() - 1;
+    return CloneLocation(file_ids[f], position - text_begin[f]);
+}
+
+/*
+ * Build the arrays and group the repeated windows.
+ * A run of suffixes whose LCP with their predecessor is at least
+ * clone_length share the same leading window, which is indexed
+ * if any of them starts a line.
+ * As the separators never appear in an indexed window, a single
+ * separator value suffices.
+ */
+void
+SuffixIndex::group()
+{
+    if (grouped)
+        return;
+    grouped = true;
+
+    text_type sa, plcp;
+    {
+        index_type max_rank;
+        text_type text(ranked_text(max_rank));
+        sa = suffix_array(text, max_rank);
+        plcp = plcp_array(text, sa);
+    }
+
+    const index_type length = clone_length;
+    const WindowHasher hasher(clone_length);
+    std::vector<index_type> run;
+    for (index_type begin = 0, end; begin < text_size; begin = end) {
+        for (end = begin + 1; end < text_size && plcp[sa[end]] >= length; end++)
+            ;
+
+        run.clear();
+        for (index_type i = begin; i < end; i++)
+            if (window_start[sa[i]])
+                run.push_back(sa[i]);
+        if (run.empty())
+            continue;
+        if (!shard.is_whole()) {
+            CloneLocation l(location(run.front()));
+            if (!shard.contains(hasher.fingerprint(token_container.offset_begin(
+                                l.get_file_id(), l.get_begin_token_offset()))))
+                continue;
+        }
+        nwindows++;
+        if (run.size() == 1)
+            continue;
+
+        // Text order is the indexing order
+        std::sort(run.begin(), run.end());
+        group_begin.push_back(locations.size());
+        for (auto p : run)
+            locations.push_back(location(p));
+    }
+    group_begin.push_back(locations.size());
+    std::vector<bool>().swap(window_start);
+}
+
+/*
+ * Move the windows seen more than once into the specified map,
+ * with their locations in indexing order, and free the index.
+ */
+void
+SuffixIndex::move_clones(CloneDetector::candidates_type &candidates)
+{
+    group();
+
+    for (std::size_t g = 0; g + 1 < group_begin.size(); g++) {
+        CloneDetector::seen_locations_type members(
+                locations.begin() + group_begin[g],
+                locations.begin() + group_begin[g + 1]);
+        const CloneLocation &first = members.front();
+        candidates.insert(std::make_pair(SeenTokens(first.get_file_id(),
+                        first.get_begin_token_offset()), std::move(members)));
+    }
+
+    std::vector<CloneLocation>().swap(locations);
+    std::vector<std::size_t>().swap(group_begin);
+}
@@ -0,0 +1,121 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A suffix array index of clone candidates
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "CandidateIndex.h"
+
+/*
+ * A suffix array and its longest common prefix (LCP) array over the
+ * concatenation of all indexed files' tokens, with a separator after
+ * each file.
+ * Suffixes sharing at least clone_length tokens occupy adjacent
+ * positions in the suffix array, so the repeated windows are found
+ * through a linear scan of the LCP array, without comparing windows.
+ * Only suffixes starting at a window the clone detector indexes
+ * (a non-empty line followed by enough tokens) are reported.
+ */
+class SuffixIndex : public CandidateIndex {
+public:
+    // Signed, as construction marks unset positions with -1
+    typedef std::int64_t index_type;
+    typedef std::vector<index_type> text_type;
+
+private:
+    const TokenContainer &token_container;
+
+    // Length of the indexed windows
+    unsigned clone_length;
+
+    // Number of threads used for ranking the tokens
+    unsigned nthreads;
+
+    // Ids of the indexed files and their start in the concatenated text
+    std::vector<CloneLocation::file_id_type> file_ids;
+    std::vector<index_type> text_begin;
+
+    // Size of the concatenated text
+    index_type text_size = 0;
+
+    // True for text positions starting an indexed window
+    std::vector<bool> window_start;
+
+    // Locations of windows seen more than once, stored group by group
+    std::vector<CloneLocation> locations;
+
+    // Index in locations of each group's first location, plus the end
+    std::vector<std::size_t> group_begin;
+
+    // True once locations have been grouped
+    bool grouped = false;
+
+    // Number of distinct windows
+    std::size_t nwindows = 0;
+
+    // Only windows in this shard are grouped
+    WindowShard shard;
+
+    // Return the concatenated text with tokens replaced by dense ranks
+    text_type ranked_text(index_type &max_rank) const;
+
+    // Return the location of the specified text position
+    CloneLocation location(index_type position) const;
+
+    // Build the arrays and group the repeated windows
+    void group();
+
+public:
+    SuffixIndex(const TokenContainer &tc, unsigned clone_length,
+            unsigned nthreads);
+
+    void index_file(const FileData &file) override;
+
+    void set_shard(const WindowShard &s) override { shard = s; }
+
+    std::size_t size() override {
+        group();
+        return nwindows;
+    }
+
+    std::size_t number_of_clones() override {
+        group();
+        return locations.size();
+    }
+
+    void move_clones(CloneDetector::candidates_type &candidates) override;
+
+    /*
+     * Return the suffix array of text, whose values must lie in
+     * the range [0, max_value].
+     * This uses the linear-time SA-IS induced sorting algorithm.
+     */
+    static text_type suffix_array(const text_type &text, index_type max_value);
+
+    /*
+     * Return the permuted LCP array of text and its suffix array sa:
+     * element p is the length of the longest common prefix of the
+     * suffix at position p and the suffix preceding it in sa
+     * (0 for the first one).
+     * This is computed in linear time, and, being indexed by text
+     * position, needs no memory beyond the result.
+     */
+    static text_type plcp_array(const text_type &text, const text_type &sa);
+};
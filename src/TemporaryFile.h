@@ -0,0 +1,45 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * Anonymous temporary files
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+/*
+ * Create a temporary file in $TMPDIR (or /tmp) and return its
+ * descriptor.  The file is unlinked at once, so that its space is
+ * reclaimed when the descriptor is closed, even on abnormal exit.
+ */
+inline int
+create_temporary_file()
+{
+    const char *dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp")
+        + "/mpcd.XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(),
+                "Error creating temporary file " + path);
+    unlink(path.c_str());
+    return fd;
+}
@@ -0,0 +1,272 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * Comparison of token sequences using SIMD instructions
+ */
+
+#include "TokenCompare.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_KERNELS
+#include <immintrin.h>
+#endif
+
+typedef FileData::token_type token_type;
+
+static std::size_t
+mismatch_scalar(const token_type *a, const token_type *b, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+        if (a[i] != b[i])
+            return i;
+    return n;
+}
+
+// Unrolling the scalar loop only adds branches, so it isn't specialized
+static token_mismatch_type
+fixed_scalar(unsigned)
+{
+    return nullptr;
+}
+
+#ifdef X86_KERNELS
+/*
+ * Kernels specialized for a length N known at compile time, for which
+ * the compiler fully unrolls the comparison; their n argument is unused.
+ * They are instantiated for the following commonly used clone lengths.
+ */
+#define FIXED_LENGTH_CASES(kernel) \
+    case 15: return kernel<15>; \
+    case 20: return kernel<20>; \
+    case 30: return kernel<30>; \
+    case 40: return kernel<40>; \
+    case 50: return kernel<50>;
+
+/*
+ * The SSE2 and AVX2 kernels compare the tail of sequences that are not
+ * a multiple of the vector width by comparing the vector ending at the
+ * sequence's end, which overlaps tokens already found equal.
+ */
+// Return the index of the first unequal of four tokens, or 4
+__attribute__((target("sse2")))
+static inline unsigned
+unequal_sse2(const token_type *a, const token_type *b)
+{
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+    unsigned equal = _mm_movemask_epi8(_mm_cmpeq_epi32(va, vb));
+    return equal == 0xffff ? 4 : __builtin_ctz(~equal) / 4;
+}
+
+__attribute__((target("sse2")))
+static std::size_t
+mismatch_sse2(const token_type *a, const token_type *b, std::size_t n)
+{
+    if (n < 4)
+        return mismatch_scalar(a, b, n);
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        unsigned j = unequal_sse2(a + i, b + i);
+        if (j < 4)
+            return i + j;
+    }
+    if (i < n) {
+        i = n - 4;
+        unsigned j = unequal_sse2(a + i, b + i);
+        if (j < 4)
+            return i + j;
+    }
+    return n;
+}
+
+template <unsigned N>
+__attribute__((target("sse2")))
+static std::size_t
+mismatch_sse2_fixed(const token_type *a, const token_type *b, std::size_t)
+{
+    static_assert(N >= 4, "Sequence shorter than a vector");
+#pragma GCC unroll 16
+    for (unsigned i = 0; i + 4 <= N; i += 4) {
+        unsigned j = unequal_sse2(a + i, b + i);
+        if (j < 4)
+            return i + j;
+    }
+    if (N % 4) {
+        unsigned j = unequal_sse2(a + N - 4, b + N - 4);
+        if (j < 4)
+            return N - 4 + j;
+    }
+    return N;
+}
+
+static token_mismatch_type
+fixed_sse2(unsigned n)
+{
+    switch (n) {
+    FIXED_LENGTH_CASES(mismatch_sse2_fixed)
+    default: return nullptr;
+    }
+}
+
+// Return the index of the first unequal of eight tokens, or 8
+__attribute__((target("avx2")))
+static inline unsigned
+unequal_avx2(const token_type *a, const token_type *b)
+{
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+    unsigned equal = _mm256_movemask_epi8(_mm256_cmpeq_epi32(va, vb));
+    return equal == 0xffffffff ? 8 : __builtin_ctz(~equal) / 4;
+}
+
+__attribute__((target("avx2")))
+static std::size_t
+mismatch_avx2(const token_type *a, const token_type *b, std::size_t n)
+{
+    if (n < 8)
+        return mismatch_sse2(a, b, n);
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        unsigned j = unequal_avx2(a + i, b + i);
+        if (j < 8)
+            return i + j;
+    }
+    if (i < n) {
+        i = n - 8;
+        unsigned j = unequal_avx2(a + i, b + i);
+        if (j < 8)
+            return i + j;
+    }
+    return n;
+}
+
+template <unsigned N>
+__attribute__((target("avx2")))
+static std::size_t
+mismatch_avx2_fixed(const token_type *a, const token_type *b, std::size_t)
+{
+    static_assert(N >= 8, "Sequence shorter than a vector");
+#pragma GCC unroll 8
+    for (unsigned i = 0; i + 8 <= N; i += 8) {
+        unsigned j = unequal_avx2(a + i, b + i);
+        if (j < 8)
+            return i + j;
+    }
+    if (N % 8) {
+        unsigned j = unequal_avx2(a + N - 8, b + N - 8);
+        if (j < 8)
+            return N - 8 + j;
+    }
+    return N;
+}
+
+static token_mismatch_type
+fixed_avx2(unsigned n)
+{
+    switch (n) {
+    FIXED_LENGTH_CASES(mismatch_avx2_fixed)
+    default: return nullptr;
+    }
+}
+
+// The tail is compared with masked loads, which never fault
+__attribute__((target("avx512f")))
+static std::size_t
+mismatch_avx512(const token_type *a, const token_type *b, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 unequal = _mm512_cmpneq_epi32_mask(
+                _mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        if (unequal)
+            return i + __builtin_ctz(unequal);
+    }
+    if (i < n) {
+        __mmask16 tail = (1U << (n - i)) - 1;
+        __mmask16 unequal = _mm512_cmpneq_epi32_mask(
+                _mm512_maskz_loadu_epi32(tail, a + i),
+                _mm512_maskz_loadu_epi32(tail, b + i));
+        if (unequal)
+            return i + __builtin_ctz(unequal);
+    }
+    return n;
+}
+
+template <unsigned N>
+__attribute__((target("avx512f")))
+static std::size_t
+mismatch_avx512_fixed(const token_type *a, const token_type *b, std::size_t)
+{
+#pragma GCC unroll 4
+    for (unsigned i = 0; i + 16 <= N; i += 16) {
+        __mmask16 unequal = _mm512_cmpneq_epi32_mask(
+                _mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        if (unequal)
+            return i + __builtin_ctz(unequal);
+    }
+    if (N % 16) {
+        const unsigned i = N - N % 16;
+        const __mmask16 tail = (1U << (N % 16)) - 1;
+        __mmask16 unequal = _mm512_cmpneq_epi32_mask(
+                _mm512_maskz_loadu_epi32(tail, a + i),
+                _mm512_maskz_loadu_epi32(tail, b + i));
+        if (unequal)
+            return i + __builtin_ctz(unequal);
+    }
+    return N;
+}
+
+static token_mismatch_type
+fixed_avx512(unsigned n)
+{
+    switch (n) {
+    FIXED_LENGTH_CASES(mismatch_avx512_fixed)
+    default: return nullptr;
+    }
+}
+#endif
+
+const std::vector<TokenKernel> &
+supported_token_kernels()
+{
+    static const std::vector<TokenKernel> kernels = [] {
+        std::vector<TokenKernel> k{{"scalar", mismatch_scalar, fixed_scalar}};
+#ifdef X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2"))
+            k.push_back({"sse2", mismatch_sse2, fixed_sse2});
+        if (__builtin_cpu_supports("avx2"))
+            k.push_back({"avx2", mismatch_avx2, fixed_avx2});
+        if (__builtin_cpu_supports("avx512f"))
+            k.push_back({"avx512", mismatch_avx512, fixed_avx512});
+#endif
+        return k;
+    }();
+    return kernels;
+}
+
+const token_mismatch_type token_mismatch_kernel =
+    supported_token_kernels().back().mismatch;
+
+token_mismatch_type
+window_mismatch_kernel(unsigned length)
+{
+    // Not token_mismatch_kernel, which may not yet be initialized
+    const TokenKernel &kernel = supported_token_kernels().back();
+    token_mismatch_type fixed = kernel.fixed(length);
+    return fixed ? fixed : kernel.mismatch;
+}
@@ -0,0 +1,125 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * Comparison of token sequences using SIMD instructions
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "TokenContainer.h"
+
+/*
+ * A kernel returning the index of the first differing token
+ * of the sequences a and b of length n, or n if they are equal.
+ */
+typedef std::size_t (*token_mismatch_type)(const FileData::token_type *a,
+        const FileData::token_type *b, std::size_t n);
+
+// Mismatch kernels implemented with a given instruction set
+struct TokenKernel {
+    const char *name;
+    token_mismatch_type mismatch;
+
+    /*
+     * Return a kernel specialized for sequences of length n,
+     * or nullptr if there is none
+     */
+    token_mismatch_type (*fixed)(unsigned n);
+};
+
+/*
+ * Return the kernels the processor supports, from the portable scalar
+ * one to the one using its widest vector instructions.
+ */
+const std::vector<TokenKernel> &supported_token_kernels();
+
+// The last of the supported kernels, selected at startup
+extern const token_mismatch_type token_mismatch_kernel;
+
+/*
+ * Return the fastest kernel for sequences of the specified length:
+ * one specialized for it, if available, or the general one.
+ */
+token_mismatch_type window_mismatch_kernel(unsigned length);
+
+typedef FileData::tokens_type::const_iterator token_iterator;
+
+// Return the index of the first differing token of a and b, or n
+inline std::size_t
+token_mismatch(token_iterator a, token_iterator b, std::size_t n)
+{
+    return n ? token_mismatch_kernel(&*a, &*b, n) : 0;
+}
+
+// Return true if the n tokens starting at a and b are equal
+inline bool
+tokens_equal(token_iterator a, token_iterator b, std::size_t n)
+{
+    return token_mismatch(a, b, n) == n;
+}
+
+/*
+ * Return a negative number, zero, or a positive number, if the n tokens
+ * starting at a are lexicographically less, equal, or greater than
+ * those starting at b.
+ */
+inline int
+token_compare(token_iterator a, token_iterator b, std::size_t n)
+{
+    // Orderings are mostly decided by the first token; avoid the call
+    if (n > 0 && a[0] != b[0])
+        return a[0] < b[0] ? -1 : 1;
+    std::size_t i = token_mismatch(a, b, n);
+    if (i == n)
+        return 0;
+    return a[i] < b[i] ? -1 : 1;
+}
+
+/*
+ * Comparison of token windows of a given length, through the kernel
+ * specialized for it, if one is available
+ */
+class WindowCompare {
+private:
+    unsigned length;
+    token_mismatch_type mismatch;
+
+public:
+    WindowCompare(unsigned length = 0) :
+        length(length), mismatch(window_mismatch_kernel(length)) {}
+
+    // Return true if the windows starting at a and b are equal
+    bool equal(token_iterator a, token_iterator b) const {
+        return length == 0 || mismatch(&*a, &*b, length) == length;
+    }
+
+    /*
+     * Return a negative number, zero, or a positive number, if the
+     * window at a is lexicographically less, equal, or greater than b
+     */
+    int compare(token_iterator a, token_iterator b) const {
+        if (length == 0)
+            return 0;
+        if (a[0] != b[0])
+            return a[0] < b[0] ? -1 : 1;
+        std::size_t i = mismatch(&*a, &*b, length);
+        if (i == length)
+            return 0;
+        return a[i] < b[i] ? -1 : 1;
+    }
+};
@@ -16,29 +16,517 @@
  * A container for the read token stream.
  */
 
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
 #include <vector>
 #include <string>
-#include <sstream>
+#include <system_error>
+#include <thread>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Parallel.h"
 #include "TokenContainer.h"
 
-// Construct from an input stream
-TokenContainer::TokenContainer(std::istream &in)
+// Size of blocks used for reading the input
+static const std::size_t BLOCK_SIZE = 4 * 1024 * 1024;
+
+/*
+ * The binary input format consists of the following elements.
+ * - A header containing the bytes of BINARY_MAGIC.
+ * - A sequence of records, each starting with an unsigned LEB128 varint
+ *   whose least significant bit identifies the record's type.
+ *   - File records have the bit set.  The remaining bits hold the
+ *     length of the file's name, whose bytes follow.
+ *   - Line records have the bit clear.  The remaining bits hold the
+ *     number of the line's tokens, which follow as varints.
+ */
+static const char BINARY_MAGIC[] = {'M', 'P', 'C', 'D', 'T', 'O', 'K', '\1'};
+
+// Returned by get_varint for a varint that does not fit in 32 bits
+static const char VARINT_OVERFLOW[1] = {};
+
+/*
+ * Decode into v the varint starting at p.
+ * Return a pointer past its end, nullptr if it extends past end,
+ * or VARINT_OVERFLOW if its value does not fit in v.
+ */
+static inline const char *
+get_varint(const char *p, const char *end, std::uint32_t &v)
+{
+    v = 0;
+    for (int shift = 0; p != end; shift += 7) {
+        if (shift >= 32)
+            return VARINT_OVERFLOW;
+        unsigned char c = *p++;
+        // The fifth byte may only hold the value's top four bits
+        if (shift == 28 && (c & 0xf0))
+            return VARINT_OVERFLOW;
+        v |= std::uint32_t(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return p;
+    }
+    return nullptr;
+}
+
+// Append to out the varint encoding of v
+static inline void
+put_varint(std::string &out, std::uint32_t v)
+{
+    while (v >= 0x80) {
+        out += char(v | 0x80);
+        v >>= 7;
+    }
+    out += char(v);
+}
+
+void
+TokenContainer::parse_error(const char *message) const
+{
+    std::string where;
+    std::size_t line = arena.line_offsets.size();
+    if (!file_data.empty()) {
+        where = file_data.back().get_name() + ":";
+        line -= file_data.back().get_line_begin_index();
+    }
+    throw std::runtime_error(where + std::to_string(line) + ": " + message);
+}
+
+/*
+ * Parse the text-format lines in the specified buffer.
+ * Return a pointer past the last completely parsed line.
+ * If at_eof is true, a final line lacking a newline is also parsed.
+ * Tokens are converted by hand, avoiding the per-line string and stream
+ * construction that the C++ library's formatted input would require.
+ * Token lines may contain only unsigned decimal numbers separated by
+ * spaces or tabs; anything else causes a runtime_error to be thrown.
+ */
+const char *
+TokenContainer::parse_text(const char *p, const char *end, bool at_eof)
 {
-    std::string line;
+    while (p != end) {
+        auto eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (eol == nullptr) {
+            if (!at_eof)
+                return p;
+            eol = end;
+        }
+
+        if (*p == 'F')
+            add_file(std::string(p + 1, eol));
+        else {
+            // Process a line's tokens
+            add_line();
+            const FileData::token_type max_token = ~FileData::token_type(0);
+            while (p != eol) {
+                if (*p == ' ' || *p == '\t') {
+                    ++p;
+                    continue;
+                }
+                if (*p < '0' || *p > '9')
+                    parse_error("Invalid character in token line");
+                FileData::token_type token = 0;
+                do {
+                    unsigned digit = *p++ - '0';
+                    if (token > (max_token - digit) / 10)
+                        parse_error("Token value out of range");
+                    token = token * 10 + digit;
+                } while (p != eol && *p >= '0' && *p <= '9');
+                add_token(token);
+            }
+        }
 
-    while (std::getline(in, line)) {
-        if (line[0] == 'F') {
-            add_file(line.substr(1));
+        if (eol == end)
+            return end;
+        p = eol + 1;
+    }
+    return p;
+}
+
+/*
+ * Parse the text-format lines in the specified buffer, by splitting
+ * it into file-aligned chunks that are parsed concurrently.
+ * The first chunk, which may continue the top-most file, is parsed
+ * directly into this container; the others, which start with a file
+ * record, are parsed into separate containers appended in input order,
+ * so that file identifiers are the same as those of a serial parse.
+ * Return a pointer past the last completely parsed line.
+ */
+const char *
+TokenContainer::parse_text_parallel(const char *begin, const char *end,
+        bool at_eof)
+{
+    if (!at_eof) {
+        // Parse only complete lines
+        while (end != begin && end[-1] != '\n')
+            --end;
+        if (end == begin)
+            return begin;
+    }
+
+    // Split the buffer at file records
+    std::vector<const char *> chunk_begin{begin};
+    std::size_t chunk_size = (end - begin) / nthreads;
+    for (unsigned i = 1; i < nthreads; i++) {
+        const char *p = std::max(chunk_begin.back(), begin + i * chunk_size);
+        while (p != end) {
+            p = static_cast<const char *>(std::memchr(p, '\n', end - p));
+            if (p == nullptr || ++p == end) {
+                p = end;
+                break;
+            }
+            if (*p == 'F')
+                break;
+        }
+        if (p == end)
+            break;
+        chunk_begin.push_back(p);
+    }
+    chunk_begin.push_back(end);
+
+    std::size_t nchunks = chunk_begin.size() - 1;
+    std::unique_ptr<TokenContainer[]> partial(new TokenContainer[nchunks - 1]);
+    parallel_for(nthreads, nchunks, [&](std::size_t i) {
+        TokenContainer &tc = i == 0 ? *this : partial[i - 1];
+        tc.parse_text(chunk_begin[i], chunk_begin[i + 1], true);
+    });
+
+    for (std::size_t i = 0; i < nchunks - 1; i++)
+        append(partial[i]);
+    return end;
+}
+
+// Record the line number of each token, processing files in parallel
+void
+TokenContainer::index_token_lines(unsigned nthreads)
+{
+    arena.token_lines.resize(arena.tokens.size());
+    parallel_for(nthreads, file_data.size(), [&](std::size_t i) {
+        file_data[i].index_token_lines(arena);
+    });
+}
+
+// Append to this container the files of the other one
+void
+TokenContainer::append(TokenContainer &other)
+{
+    end_file();
+    other.end_file();
+
+    std::size_t token_delta = arena.tokens.size();
+    std::size_t line_delta = arena.line_offsets.size();
+    arena.tokens.insert(arena.tokens.end(), other.arena.tokens.begin(),
+            other.arena.tokens.end());
+    arena.line_offsets.insert(arena.line_offsets.end(),
+            other.arena.line_offsets.begin(), other.arena.line_offsets.end());
+
+    for (auto& file : other.file_data) {
+        file.relocate(file_data.size(), arena, token_delta, line_delta);
+        file_data.push_back(std::move(file));
+    }
+    other.file_data.clear();
+    if (!file_data.empty())
+        file_token_begin = file_data.back().get_token_begin();
+}
+
+/*
+ * Parse the binary-format records in the specified buffer.
+ * Return a pointer past the last completely parsed record.
+ * Throw a runtime_error on malformed input or, if at_eof is set,
+ * on a record that is truncated by the input's end.
+ */
+const char *
+TokenContainer::parse_binary(const char *p, const char *end, bool at_eof)
+{
+    while (p != end) {
+        std::uint32_t v;
+        const char *q = get_varint(p, end, v);
+        if (q == VARINT_OVERFLOW)
+            throw std::runtime_error("Malformed binary input");
+        if (q == nullptr)
+            break;
+
+        std::uint32_t length = v >> 1;
+        if (v & 1) {
+            if (std::size_t(end - q) < length)
+                break;
+            add_file(std::string(q, q + length));
+            p = q + length;
             continue;
         }
 
-        // Process a line's tokens
+        // Verify that an incomplete line's tokens are all available
+        if (std::size_t(end - q) < 5 * std::size_t(length)) {
+            const char *r = q;
+            for (std::uint32_t i = 0; i < length && r != nullptr; i++) {
+                r = get_varint(r, end, v);
+                if (r == VARINT_OVERFLOW)
+                    throw std::runtime_error("Malformed binary input");
+            }
+            if (r == nullptr)
+                break;
+        }
+
         add_line();
-        std::istringstream iss(line);
-        int token;
-        while (iss >> token)
-            add_token(token);
+        for (std::uint32_t i = 0; i < length; i++) {
+            q = get_varint(q, end, v);
+            if (q == VARINT_OVERFLOW)
+                throw std::runtime_error("Malformed binary input");
+            add_token(v);
+        }
+        p = q;
+    }
+    if (at_eof && p != end)
+        throw std::runtime_error("Truncated binary input");
+    return p;
+}
+
+/*
+ * Parse the specified input buffer, which starts at the beginning
+ * of the input, according to the format identified by its header.
+ * Return a pointer past the last completely parsed element.
+ */
+const char *
+TokenContainer::parse_input(const char *begin, const char *end, bool at_eof)
+{
+    std::size_t magic_size = sizeof(BINARY_MAGIC);
+
+    if (std::size_t(end - begin) < magic_size && !at_eof)
+        return begin;  // Wait for more data
+
+    if (std::size_t(end - begin) >= magic_size
+            && std::memcmp(begin, BINARY_MAGIC, magic_size) == 0) {
+        parse = &TokenContainer::parse_binary;
+        return parse_binary(begin + magic_size, end, at_eof);
+    } else {
+        if (nthreads > 1)
+            parse = &TokenContainer::parse_text_parallel;
+        else
+            parse = &TokenContainer::parse_text;
+        return (this->*parse)(begin, end, at_eof);
+    }
+}
+
+template <typename Reader>
+void
+TokenContainer::read_blocks(Reader reader)
+{
+    // Provide each thread with a block of its own
+    std::vector<char> buffer(BLOCK_SIZE * nthreads);
+    std::size_t pending = 0;  // Unparsed bytes at the buffer's beginning
+
+    for (;;) {
+        // Grow the buffer if it can't hold a single line
+        if (pending == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        std::size_t n = reader(buffer.data() + pending, buffer.size() - pending);
+        // Collect a full buffer to divide among multiple threads
+        if (nthreads > 1)
+            for (std::size_t r = n; r != 0 && pending + n < buffer.size(); n += r)
+                r = reader(buffer.data() + pending + n,
+                        buffer.size() - pending - n);
+        input_size += n;
+        bool at_eof = (n == 0);
+        const char *begin = buffer.data();
+        const char *end = begin + pending + n;
+        const char *parsed = (this->*parse)(begin, end, at_eof);
+        if (at_eof) {
+            end_file();
+            return;
+        }
+        pending = end - parsed;
+        std::memmove(buffer.data(), parsed, pending);
+    }
+}
+
+// Construct from an input stream
+TokenContainer::TokenContainer(std::istream &in)
+{
+    read_blocks([&in](char *buffer, std::size_t size) -> std::size_t {
+        in.read(buffer, size);
+        return in.gcount();
+    });
+}
+
+/*
+ * A reader of a file descriptor's contents through a separate thread,
+ * which fills one of two buffers while the other one is being consumed.
+ * Data are made available to the consumer as soon as they are read.
+ */
+class PrefetchReader {
+private:
+    int fd;
+
+    // Buffers and the number of bytes read into each one
+    std::vector<char> buffer[2];
+    std::size_t buffer_size[2] = {0, 0};
+
+    // True if no more data will be read into a buffer
+    bool full[2] = {false, false};
+
+    // Error number of a failed read; 0 if none
+    int error = 0;
+
+    // True when the consumer has stopped reading
+    bool stopped = false;
+
+    // Buffer being consumed and the consumed data's position in it
+    int consume_index = 0;
+    std::size_t consume_pos = 0;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+
+    // Fill the two buffers in turn until EOF; a partial one signifies EOF
+    void prefetch() {
+        for (int i = 0;; i ^= 1) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !full[i] || stopped; });
+                if (stopped)
+                    return;
+            }
+
+            // The consumer only accesses data up to buffer_size[i]
+            std::size_t n = 0;
+            for (;;) {
+                ssize_t r = ::read(fd, buffer[i].data() + n,
+                        buffer[i].size() - n);
+                if (r < 0 && errno == EINTR)
+                    continue;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (r > 0)
+                    buffer_size[i] = (n += r);
+                else if (r < 0)
+                    error = errno;
+                if (r <= 0 || n == buffer[i].size())
+                    full[i] = true;
+                changed.notify_all();
+                if (r <= 0)
+                    return;
+                if (full[i])
+                    break;
+            }
+        }
+    }
+
+public:
+    PrefetchReader(int fd, std::size_t size) : fd(fd) {
+        buffer[0].resize(size);
+        buffer[1].resize(size);
+        thread = std::thread(&PrefetchReader::prefetch, this);
+    }
+
+    ~PrefetchReader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+            changed.notify_all();
+        }
+        thread.join();
+    }
+
+    // Copy into dest up to size bytes; return the number copied, 0 on EOF
+    std::size_t read(char *dest, std::size_t size) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            int i = consume_index;
+            changed.wait(lock, [&] {
+                return buffer_size[i] > consume_pos || full[i];
+            });
+
+            std::size_t n = std::min(size, buffer_size[i] - consume_pos);
+            if (n > 0) {
+                std::memcpy(dest, buffer[i].data() + consume_pos, n);
+                consume_pos += n;
+                return n;
+            }
+
+            if (error)
+                throw std::system_error(error, std::generic_category(),
+                        "Error reading input");
+            if (buffer_size[i] < buffer[i].size())
+                return 0;  // EOF
+
+            // Hand the consumed buffer back to the prefetching thread
+            buffer_size[i] = 0;
+            full[i] = false;
+            consume_index ^= 1;
+            consume_pos = 0;
+            changed.notify_all();
+        }
+    }
+};
+
+/*
+ * Read tokens from the specified file descriptor.
+ * Regular files are memory-mapped; other ones are read in blocks
+ * by a separate thread, which reads ahead while the input is parsed.
+ * Text input is parsed using the specified number of threads.
+ * If a callback is specified, it is called with each file as soon
+ * as the file has been read; the input is then parsed serially.
+ */
+void
+TokenContainer::read(int fd, unsigned nthreads, file_callback_type callback)
+{
+    this->nthreads = callback ? 1 : nthreads;
+    file_callback = callback;
+    struct stat sb;
+
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        void *data = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, sb.st_size, MADV_SEQUENTIAL);
+            auto begin = static_cast<const char *>(data);
+            parse_input(begin, begin + sb.st_size, true);
+            end_file();
+            input_size += sb.st_size;
+            munmap(data, sb.st_size);
+            file_callback = nullptr;
+            return;
+        }
+    }
+
+    PrefetchReader prefetch_reader(fd, BLOCK_SIZE * this->nthreads);
+    read_blocks([&prefetch_reader](char *buffer, std::size_t size) {
+        return prefetch_reader.read(buffer, size);
+    });
+    file_callback = nullptr;
+}
+
+// Write the container's contents in the binary input format
+void
+TokenContainer::write_binary(std::ostream &out) const
+{
+    std::string record;
+
+    out.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    for (const auto& file : file_view()) {
+        record.clear();
+        const std::string &name = file.get_name();
+        put_varint(record, std::uint32_t(name.size()) << 1 | 1);
+        record += name;
+
+        for (const auto& line : file.line_view()) {
+            auto begin = file.line_offset(line);
+            auto end = line + 1 == file.line_size()
+                ? file.token_size() : file.line_offset(line + 1);
+            put_varint(record, std::uint32_t(end - begin) << 1);
+            for (auto o = begin; o != end; ++o)
+                put_varint(record, file.get_token(o));
+        }
+        out.write(record.data(), record.size());
     }
 }
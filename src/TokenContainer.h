@@ -19,23 +19,64 @@
 #pragma once
 
 #include <algorithm>
+#include <functional>
 #include <istream>
 #include <vector>
 #include <string>
 #include <iostream>
 
 #include "CollectionViews.h"
+#include "MappedAllocator.h"
 
 class FileData;
 
 typedef std::vector<FileData> FileDataCollection;
 typedef FileDataCollection::size_type file_id_type;
 
+/*
+ * The tokens and line offsets of all files, stored contiguously
+ * in two corpus-wide arrays of plain values.
+ * Each file occupies a range of each array.
+ */
+struct TokenArena {
+    typedef unsigned int token_type;
+    typedef std::vector<token_type, MappedAllocator<token_type>> tokens_type;
+    typedef tokens_type::size_type token_offset_type;
+
+    // Tokens of all files
+    tokens_type tokens;
+
+    // Offset in each file's tokens of the file's lines
+    std::vector<token_offset_type, MappedAllocator<token_offset_type>>
+        line_offsets;
+
+    typedef unsigned int token_line_type;
+
+    // Optional line number in its file of each token
+    std::vector<token_line_type, MappedAllocator<token_line_type>>
+        token_lines;
+
+    /*
+     * Keep the arrays in memory mapped from temporary files, so that
+     * the operating system can page them out.  Call on an empty arena.
+     */
+    void map_to_files() {
+        tokens = decltype(tokens)(MappedAllocator<token_type>(true));
+        line_offsets = decltype(line_offsets)(
+                MappedAllocator<token_offset_type>(true));
+        token_lines = decltype(token_lines)(
+                MappedAllocator<token_line_type>(true));
+    }
+};
+
 // Data stored about each file
 class FileData {
 public:
-    typedef unsigned int token_type;
-    typedef std::vector<token_type> tokens_type;
+    typedef TokenArena::token_type token_type;
+    typedef TokenArena::tokens_type tokens_type;
+    typedef TokenArena::token_offset_type token_offset_type;
+    typedef decltype(TokenArena::line_offsets) line_offsets_type;
+    typedef line_offsets_type::size_type line_number_type;
 
 private:
     // File name
@@ -44,54 +85,78 @@ private:
     // Identifier
     file_id_type id;
 
-    // Tokens of all files
-    tokens_type tokens;
+    // Storage of the file's tokens and line offsets
+    const TokenArena *arena;
 
-public:
-    typedef tokens_type::size_type token_offset_type;
+    // Index of the file's first token and line in the arena
+    std::size_t token_begin;
+    std::size_t line_begin_index;
 
-private:
-    // Offsset in tokens of each line
-    std::vector<token_offset_type> line_offsets;
-public:
-    typedef decltype(line_offsets)::size_type line_number_type;
+    // Number of the file's tokens and lines
+    std::size_t ntokens = 0;
+    std::size_t nlines = 0;
 
+    // Return the offset of the tokens starting in the specified line
+    token_offset_type line_offset_at(line_number_type line_number) const {
+        return arena->line_offsets[line_begin_index + line_number];
+    }
+
+    // Return an iterator to the token at the specified offset
+    tokens_type::const_iterator token_at(token_offset_type o) const {
+        return arena->tokens.begin() + token_begin + o;
+    }
+
+public:
     file_id_type get_id() const { return id; }
 
-    // Construct given a file name
-    FileData(std::string name, file_id_type id) : name(name), id(id) {}
+    /*
+     * Construct given a file name and the arena in which its tokens
+     * and lines will be stored from its current end onward
+     */
+    FileData(std::string name, file_id_type id, const TokenArena &arena) :
+        name(name), id(id), arena(&arena),
+        token_begin(arena.tokens.size()),
+        line_begin_index(arena.line_offsets.size()) {}
+
+    /*
+     * Move the file's reference to the specified arena, where it is
+     * stored at the given distance from its previous position
+     */
+    void relocate(file_id_type new_id, const TokenArena &new_arena,
+            std::size_t token_delta, std::size_t line_delta) {
+        id = new_id;
+        arena = &new_arena;
+        token_begin += token_delta;
+        line_begin_index += line_delta;
+    }
 
-    // Add a token at the end
-    void add_token(token_type token) {
-        tokens.push_back(token);
+    // Set the file's extent to the end of the arena's current contents
+    void set_end() {
+        ntokens = arena->tokens.size() - token_begin;
+        nlines = arena->line_offsets.size() - line_begin_index;
     }
 
+    // Return the index of the file's first token in the arena
+    std::size_t get_token_begin() const { return token_begin; }
+
+    // Return the index of the file's first line in the arena
+    std::size_t get_line_begin_index() const { return line_begin_index; }
+
     // Return file's number of lines
     std::size_t line_size() const {
-        return line_offsets.size();
+        return nlines;
     }
 
     // Return file's number of tokens
     std::size_t token_size() const {
-        return tokens.size();
-    }
-
-    // Add a line's offset at the end of the existing vector's elements
-    void add_line() {
-        line_offsets.push_back(tokens.size());
-    }
-
-    // Shrink excessively allocated capacity
-    void shrink_to_fit() {
-        tokens.shrink_to_fit();
-        line_offsets.shrink_to_fit();
+        return ntokens;
     }
 
     const std::string &get_name() const { return name; }
 
     // Return an iterator over the container's lines (line numbers)
-    IndexRange<decltype(line_offsets)> line_view() const {
-        return IndexRange<decltype(line_offsets)>(line_offsets.size());
+    IndexRange<line_offsets_type> line_view() const {
+        return IndexRange<line_offsets_type>(nlines);
     }
 
     /*
@@ -99,10 +164,10 @@ public:
      * Internally line numbers are 0-based
      */
     bool line_is_empty(line_number_type line_number) const {
-        if (line_number == line_offsets.size() - 1)
-            return line_offsets[line_number] == tokens.size();
+        if (line_number == nlines - 1)
+            return line_offset_at(line_number) == ntokens;
         else
-            return line_offsets[line_number] == line_offsets[line_number + 1];
+            return line_offset_at(line_number) == line_offset_at(line_number + 1);
     }
 
     /*
@@ -111,88 +176,209 @@ public:
      * Internally line numbers are 0-based
      */
     token_offset_type remaining_tokens(line_number_type line_number) const {
-        return tokens.size() - line_offsets[line_number];
+        return ntokens - line_offset_at(line_number);
     }
 
     // Return an iterator to the tokens starting in the specified line
     tokens_type::const_iterator line_begin(line_number_type line_number) const {
-        return tokens.begin() + line_offsets[line_number];
+        return token_at(line_offset_at(line_number));
     }
 
     // Return an iterator on the file's end
     tokens_type::const_iterator file_end() const {
-        return tokens.end();
+        return token_at(ntokens);
     }
 
     // Return an iterator to the tokens starting at the specified offset
     tokens_type::const_iterator offset_begin(token_offset_type o) const {
-        return tokens.begin() + o;
+        return token_at(o);
     }
 
     // Return the offset of the tokens starting in the specified line
     token_offset_type line_offset(line_number_type line_number) const {
-        return line_offsets[line_number];
+        return line_offset_at(line_number);
+    }
+
+    // Set the line number of each of the file's tokens in the arena
+    void index_token_lines(TokenArena &to) const {
+        for (line_number_type line = 0; line < nlines; line++) {
+            token_offset_type end = line + 1 == nlines ? ntokens
+                : line_offset_at(line + 1);
+            std::fill(to.token_lines.begin() + token_begin
+                    + line_offset_at(line),
+                    to.token_lines.begin() + token_begin + end,
+                    TokenArena::token_line_type(line));
+        }
     }
 
     // Return the (0-based) line number to which a token belongs
     line_number_type get_token_line_number(token_offset_type offset) const {
+        if (!arena->token_lines.empty() && offset < ntokens)
+            return arena->token_lines[token_begin + offset];
+
         // First line with an offset greater than offset
-        auto upper = std::upper_bound(line_offsets.begin(), line_offsets.end(), offset);
-        return std::distance(line_offsets.begin(), upper) - 1;
+        auto lines_begin = arena->line_offsets.begin() + line_begin_index;
+        auto upper = std::upper_bound(lines_begin, lines_begin + nlines, offset);
+        return std::distance(lines_begin, upper) - 1;
     }
 
     // Return an iterator to the end of the line to which a token belongs
     tokens_type::const_iterator line_from_offset_end(token_offset_type o) const {
         auto next_line_number = get_token_line_number(o) + 1;
-        if (next_line_number == line_offsets.size())
+        if (next_line_number == nlines)
             return file_end();
         else
-            return tokens.begin() + line_offsets[next_line_number];
+            return token_at(line_offset_at(next_line_number));
     }
 
     // Return the token at the specified location; 0 if at EOF
     FileData::token_type get_token(FileData::token_offset_type offset) const {
-        if (tokens.begin() + offset == tokens.end())
+        if (offset >= ntokens)
             return 0;
-        return tokens[offset];
+        return *token_at(offset);
     }
 
     // Return the end-offset of the line lying immediately before the offset
     FileData::token_offset_type get_preceding_eol_offset(
         FileData::token_offset_type offset) const {
-        if (offset == tokens.size())
-            return tokens.size();
+        if (offset == ntokens)
+            return ntokens;
         auto line_number = get_token_line_number(offset);
-        return line_offsets[line_number];
+        return line_offset_at(line_number);
     }
 };
 
 class TokenContainer {
 private:
+    // Tokens and line offsets of all files
+    TokenArena arena;
+
     FileDataCollection file_data;
 
+    // Index in the arena of the top-most file's first token
+    std::size_t file_token_begin = 0;
+
+    // Number of input bytes processed
+    std::size_t input_size = 0;
+
+    // Number of threads to use for parsing the input
+    unsigned nthreads = 1;
+
+    /*
+     * Parse the text-format lines in the specified buffer.
+     * Return a pointer past the last completely parsed line.
+     * If at_eof is true, a final line lacking a newline is also parsed.
+     */
+    const char *parse_text(const char *begin, const char *end, bool at_eof);
+
+    // Throw a runtime_error about the top-most file's last line
+    [[noreturn]] void parse_error(const char *message) const;
+
+    /*
+     * Parse the text-format lines in the specified buffer, by splitting
+     * it into file-aligned chunks that are parsed concurrently.
+     * Return a pointer past the last completely parsed line.
+     */
+    const char *parse_text_parallel(const char *begin, const char *end,
+            bool at_eof);
+
+    /*
+     * Parse the binary-format records in the specified buffer.
+     * Return a pointer past the last completely parsed record.
+     */
+    const char *parse_binary(const char *begin, const char *end, bool at_eof);
+
+    /*
+     * Parse the specified input buffer, which starts at the beginning
+     * of the input, according to the format identified by its header.
+     * Return a pointer past the last completely parsed element.
+     */
+    const char *parse_input(const char *begin, const char *end, bool at_eof);
+
+    // Pointer to the function used for parsing the remaining input
+    const char *(TokenContainer::*parse)(const char *begin, const char *end,
+            bool at_eof) = &TokenContainer::parse_input;
+
+    /*
+     * Read and parse input in large blocks obtained through the
+     * specified reader, which is called to fill a buffer with up to
+     * the given number of bytes and returns the number of bytes read.
+     */
+    template <typename Reader> void read_blocks(Reader reader);
+
+    // Append to this container the files of the other one
+    void append(TokenContainer &other);
+
+    // Function called on each file whose reading has been completed
+    std::function<void(const FileData &)> file_callback;
+
+    // Number of files passed to file_callback
+    std::size_t files_completed = 0;
+
+    // Record the extent of the top-most file
+    void end_file() {
+        if (file_data.empty())
+            return;
+        file_data.back().set_end();
+        if (file_callback && files_completed < file_data.size()) {
+            files_completed = file_data.size();
+            file_callback(file_data.back());
+        }
+    }
+
     // Add a new file, which becomes the top-most one
     void add_file(const std::string &name) {
-        if (!file_data.empty())
-            file_data.back().shrink_to_fit();
-        file_data.push_back(FileData(name, file_data.size()));
+        end_file();
+        file_token_begin = arena.tokens.size();
+        file_data.push_back(FileData(name, file_data.size(), arena));
     }
 
     // Add a token to the top-most file
     void add_token(FileData::token_type token) {
-        file_data.back().add_token(token);
+        arena.tokens.push_back(token);
     }
 
     // Add a line to the top-most file
     void add_line() {
-        file_data.back().add_line();
+        arena.line_offsets.push_back(arena.tokens.size() - file_token_begin);
     }
 public:
     typedef FileDataCollection::size_type file_id_type;
 
+    // Files refer to the container's arena, so it can't be copied
+    TokenContainer(const TokenContainer &) = delete;
+    TokenContainer &operator=(const TokenContainer &) = delete;
+
+    typedef std::function<void(const FileData &)> file_callback_type;
+
+    // Construct an empty container
+    TokenContainer() {}
+
     // Construct from an input stream
     TokenContainer(std::istream &in);
 
+    // Construct by reading from the specified file descriptor
+    TokenContainer(int fd, unsigned nthreads = 1) {
+        read(fd, nthreads);
+    }
+
+    /*
+     * Read tokens from the specified file descriptor.
+     * Regular files are memory-mapped; other ones are read in blocks
+     * by a separate thread, which reads ahead while the input is parsed.
+     * Text input is parsed using the specified number of threads.
+     * If a callback is specified, it is called with each file as soon
+     * as the file has been read; the input is then parsed serially.
+     */
+    void read(int fd, unsigned nthreads = 1,
+            file_callback_type callback = nullptr);
+
+    // Return the number of input bytes processed
+    std::size_t get_input_size() const { return input_size; }
+
+    // Write the container's contents in the binary input format
+    void write_binary(std::ostream &out) const;
+
     // Return an iterator over the container's files
     ConstCollectionView<FileDataCollection> file_view() const {
         return file_data;
@@ -205,22 +391,37 @@ public:
 
     // Return number of tokens
     std::size_t token_size() const {
-        std::size_t ntokens = 0;
-        for (auto& file : file_data)
-            ntokens += file.token_size();
-        return ntokens;
+        return arena.tokens.size();
     }
 
     // Return number of lines
     std::size_t line_size() const {
-        std::size_t nlines = 0;
-        for (auto& file : file_data)
-            nlines += file.line_size();
-        return nlines;
+        return arena.line_offsets.size();
     }
 
+    // Return the arena holding the tokens and line offsets of all files
+    const TokenArena &get_arena() const { return arena; }
+
+    /*
+     * Keep the tokens in memory mapped from temporary files, which
+     * the operating system can page out.  Call before reading.
+     */
+    void map_to_files() { arena.map_to_files(); }
+
+    /*
+     * Record the line number of each token, so that it is found
+     * without searching the file's lines, at the cost of four
+     * bytes per token.  Call after reading.
+     */
+    void index_token_lines(unsigned nthreads = 1);
+
     // Return number of tokens
 
+    // Return a file's data
+    const FileData& get_file(file_id_type id) const {
+        return file_data[id];
+    }
+
     // Return a file's name
     const std::string& get_file_name(file_id_type id) const {
         return file_data[id].get_name();
@@ -1,13 +1,29 @@
 #pragma once
 
 #include <cppunit/extensions/HelperMacros.h>
+#include <cstdio>
+#include <cstdlib>
 #include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
 
 #include "TokenContainer.h"
 
 class TokenContainerTest : public CppUnit::TestFixture  {
     CPPUNIT_TEST_SUITE(TokenContainerTest);
     CPPUNIT_TEST(test_construct);
+    CPPUNIT_TEST(test_construct_fd_file);
+    CPPUNIT_TEST(test_construct_fd_pipe);
+    CPPUNIT_TEST(test_parse_large_token);
+    CPPUNIT_TEST(test_parse_malformed);
+    CPPUNIT_TEST(test_binary_round_trip);
+    CPPUNIT_TEST(test_binary_fd);
+    CPPUNIT_TEST(test_binary_truncated);
+    CPPUNIT_TEST(test_binary_malformed_varint);
+    CPPUNIT_TEST(test_arena);
+    CPPUNIT_TEST(test_construct_parallel);
+    CPPUNIT_TEST(test_mapped_arena);
     CPPUNIT_TEST(test_line_number_empty_last_full);
     CPPUNIT_TEST(test_line_number_empty_last_empty);
     CPPUNIT_TEST(test_line_view);
@@ -16,6 +32,7 @@ class TokenContainerTest : public CppUnit::TestFixture  {
     CPPUNIT_TEST(test_line_offset);
     CPPUNIT_TEST(test_get_file_name);
     CPPUNIT_TEST(test_get_token_line_number);
+    CPPUNIT_TEST(test_index_token_lines);
     CPPUNIT_TEST(test_get_offset_begin);
     CPPUNIT_TEST(test_line_end);
     CPPUNIT_TEST(test_get_token);
@@ -31,6 +48,189 @@ public:
         }
     }
 
+    // Return a file descriptor from which the specified string can be read
+    static int string_fd(const std::string &s) {
+        char path[] = "/tmp/mpcd-test-XXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd != -1);
+        unlink(path);
+        CPPUNIT_ASSERT(write(fd, s.data(), s.size()) == (ssize_t)s.size());
+        lseek(fd, 0, SEEK_SET);
+        return fd;
+    }
+
+    void test_construct_fd_file() {
+        int fd = string_fd("Fa\n12 42\n\n7\nFb\n1 2\n3");
+        TokenContainer tc(fd);
+        close(fd);
+
+        CPPUNIT_ASSERT_EQUAL(std::size_t(2), tc.file_size());
+        CPPUNIT_ASSERT_EQUAL(std::string("b"), tc.get_file_name(1));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(5), tc.line_size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(6), tc.token_size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(20), tc.get_input_size());
+        CPPUNIT_ASSERT_EQUAL((FileData::token_type)3, tc.get_token(1, 2));
+    }
+
+    void test_construct_fd_pipe() {
+        int fds[2];
+        CPPUNIT_ASSERT(pipe(fds) == 0);
+        std::string s("Fa\n12 42\n\n7\n");
+        CPPUNIT_ASSERT(write(fds[1], s.data(), s.size()) == (ssize_t)s.size());
+        close(fds[1]);
+        TokenContainer tc(fds[0]);
+        close(fds[0]);
+
+        CPPUNIT_ASSERT_EQUAL(std::size_t(1), tc.file_size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(3), tc.line_size());
+        CPPUNIT_ASSERT_EQUAL((FileData::token_type)7, tc.get_token(0, 2));
+    }
+
+    void test_parse_large_token() {
+        std::istringstream iss("Fname\n4294967295\t0 \n");
+        TokenContainer tc(iss);
+
+        CPPUNIT_ASSERT_EQUAL(std::size_t(2), tc.token_size());
+        CPPUNIT_ASSERT_EQUAL((FileData::token_type)4294967295U, tc.get_token(0, 0));
+        CPPUNIT_ASSERT_EQUAL((FileData::token_type)0, tc.get_token(0, 1));
+    }
+
+    void test_parse_malformed() {
+        for (const char *input : {"Fa\n1 -2 3\n", "Fa\n1 x2 3\n",
+                "Fa\n1 99999999999\n", "Fa\n4294967296\n"}) {
+            std::istringstream iss(input);
+            CPPUNIT_ASSERT_THROW(TokenContainer tc(iss), std::runtime_error);
+        }
+
+        std::istringstream iss("Fa\n1 2\n\n3 -4\n");
+        try {
+            TokenContainer tc(iss);
+            CPPUNIT_FAIL("No exception thrown");
+        } catch (const std::runtime_error &e) {
+            CPPUNIT_ASSERT_EQUAL(std::string("a:3: Invalid character in token line"),
+                    std::string(e.what()));
+        }
+    }
+
+    // Return the binary format representation of the specified text input
+    static std::string to_binary(const std::string &text) {
+        std::istringstream iss(text);
+        TokenContainer tc(iss);
+        std::ostringstream oss;
+        tc.write_binary(oss);
+        return oss.str();
+    }
+
+    void test_binary_round_trip() {
+        std::string text("Fname\n12 42\n\n7 300\nFother\n\n4294967295\n");
+        std::string binary(to_binary(text));
+        CPPUNIT_ASSERT(binary.size() < text.size() + 8);
+
+        std::istringstream iss(binary);
+        TokenContainer tc(iss);
+        CPPUNIT_ASSERT_EQUAL(std::size_t(2), tc.file_size());
+        CPPUNIT_ASSERT_EQUAL(std::string("other"), tc.get_file_name(1));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(5), tc.line_size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(5), tc.token_size());
+        CPPUNIT_ASSERT_EQUAL((FileData::token_type)300, tc.get_token(0, 3));
+        CPPUNIT_ASSERT_EQUAL((FileData::token_type)4294967295U, tc.get_token(1, 0));
+        CPPUNIT_ASSERT_EQUAL(FileData::line_number_type(2), tc.get_token_line_number(0, 2));
+        CPPUNIT_ASSERT_EQUAL(binary, to_binary(binary));
+    }
+
+    void test_binary_fd() {
+        int fd = string_fd(to_binary("Fname\n12 42\n\n7\n"));
+        TokenContainer tc(fd);
+        close(fd);
+
+        CPPUNIT_ASSERT_EQUAL(std::size_t(1), tc.file_size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(3), tc.line_size());
+        CPPUNIT_ASSERT_EQUAL((FileData::token_type)7, tc.get_token(0, 2));
+    }
+
+    void test_binary_truncated() {
+        std::string binary(to_binary("Fname\n12 42\n\n7 300\n"));
+        for (std::size_t n = 1; n <= 3; n++) {
+            std::istringstream iss(binary.substr(0, binary.size() - n));
+            CPPUNIT_ASSERT_THROW(TokenContainer tc(iss), std::runtime_error);
+        }
+    }
+
+    void test_binary_malformed_varint() {
+        for (const char *varint : {"\377\377\377\377\377\377\001",
+                "\377\377\377\377\177", "\200\200\200\200\020"}) {
+            std::istringstream iss(to_binary("") + varint);
+            CPPUNIT_ASSERT_THROW(TokenContainer tc(iss), std::runtime_error);
+        }
+    }
+
+    void test_arena() {
+        std::istringstream iss("Fa\n12 42\n\n7\nFb\n1 2\n3\n");
+        TokenContainer tc(iss);
+
+        const TokenArena &arena = tc.get_arena();
+        CPPUNIT_ASSERT_EQUAL(std::size_t(6), arena.tokens.size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(5), arena.line_offsets.size());
+        std::size_t token_begin = 0;
+        for (const auto& file : tc.file_view()) {
+            CPPUNIT_ASSERT_EQUAL(token_begin, file.get_token_begin());
+            CPPUNIT_ASSERT(&*file.offset_begin(0) == &arena.tokens[token_begin]);
+            token_begin += file.token_size();
+        }
+        CPPUNIT_ASSERT_EQUAL(std::size_t(3), tc.file_view().begin()->token_size());
+        CPPUNIT_ASSERT_EQUAL(FileData::token_offset_type(2), tc.get_preceding_eol_offset(1, 2));
+        CPPUNIT_ASSERT_EQUAL(FileData::token_offset_type(3), tc.get_preceding_eol_offset(1, 3));
+        CPPUNIT_ASSERT_EQUAL((FileData::token_type)0, tc.get_token(0, 3));
+    }
+
+    void test_construct_parallel() {
+        std::ostringstream input;
+        for (int i = 0; i < 50; i++) {
+            input << "Ffile" << i << "\n";
+            for (int j = 0; j < i % 7; j++)
+                input << i << ' ' << j << "\n\n" << j << "\n";
+        }
+
+        std::istringstream iss(input.str());
+        TokenContainer serial(iss);
+        int fd = string_fd(input.str());
+        TokenContainer parallel(fd, 4);
+        close(fd);
+
+        CPPUNIT_ASSERT_EQUAL(serial.file_size(), parallel.file_size());
+        CPPUNIT_ASSERT_EQUAL(serial.line_size(), parallel.line_size());
+        CPPUNIT_ASSERT_EQUAL(serial.token_size(), parallel.token_size());
+        CPPUNIT_ASSERT(serial.get_arena().tokens == parallel.get_arena().tokens);
+        CPPUNIT_ASSERT(serial.get_arena().line_offsets == parallel.get_arena().line_offsets);
+        auto serial_file = serial.file_view().begin();
+        for (const auto& file : parallel.file_view()) {
+            CPPUNIT_ASSERT_EQUAL(serial_file->get_id(), file.get_id());
+            CPPUNIT_ASSERT_EQUAL(serial_file->get_name(), file.get_name());
+            CPPUNIT_ASSERT_EQUAL(serial_file->token_size(), file.token_size());
+            CPPUNIT_ASSERT_EQUAL(serial_file->line_size(), file.line_size());
+            ++serial_file;
+        }
+    }
+
+    void test_mapped_arena() {
+        std::string input("Fa\n12 42\n\n7\nFb\n1 2\n3\n");
+        std::istringstream iss(input);
+        TokenContainer heap(iss);
+
+        for (unsigned nthreads : {1, 3}) {
+            int fd = string_fd(input);
+            TokenContainer mapped;
+            mapped.map_to_files();
+            mapped.read(fd, nthreads);
+            close(fd);
+
+            CPPUNIT_ASSERT(mapped.get_arena().tokens.get_allocator().is_file_backed());
+            CPPUNIT_ASSERT(heap.get_arena().tokens == mapped.get_arena().tokens);
+            CPPUNIT_ASSERT(heap.get_arena().line_offsets == mapped.get_arena().line_offsets);
+            CPPUNIT_ASSERT_EQUAL((FileData::token_type)3, mapped.get_token(1, 2));
+        }
+    }
+
     void test_line_number_empty_last_full() {
         std::istringstream iss("Fname\n12 42\n\n7\n");
         TokenContainer tc(iss);
@@ -128,6 +328,22 @@ public:
         CPPUNIT_ASSERT_EQUAL(FileData::line_number_type(1), tc2.get_token_line_number(0, 3));
     }
 
+    void test_index_token_lines() {
+        std::istringstream iss("Fa\n12 42\n\n7\n\nFb\n\n1 2 3\n4\nFc\nFd\n5 6\n\n");
+        TokenContainer searched(iss);
+        iss.clear();
+        iss.seekg(0);
+        TokenContainer indexed(iss);
+        indexed.index_token_lines(2);
+
+        for (const auto& file : searched.file_view())
+            for (std::size_t o = 0; o <= file.token_size(); o++)
+                CPPUNIT_ASSERT_EQUAL(file.get_token_line_number(o),
+                        indexed.get_token_line_number(file.get_id(), o));
+        CPPUNIT_ASSERT_EQUAL(FileData::line_number_type(2),
+                indexed.get_token_line_number(1, 3));
+    }
+
     void test_get_offset_begin() {
         std::istringstream iss("Fname\n12 42\n\n7\n\n");
         TokenContainer tc(iss);
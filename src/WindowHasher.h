@@ -0,0 +1,144 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * Fingerprints of the fixed-length token windows starting at line starts
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "TokenContainer.h"
+#include "WindowSketch.h"
+
+/*
+ * One of a number of parts into which windows are split by their
+ * fingerprint, so that separate processes can each detect the clones
+ * of one part.  Shards select windows by the high bits of a product
+ * of the fingerprint, which are independent of the fingerprint bits
+ * that indices use for selecting slots or their own shards.
+ */
+struct WindowShard {
+    unsigned index = 0;
+    unsigned count = 1;
+
+    // Return true if the shard covers all windows
+    bool is_whole() const { return count == 1; }
+
+    // Return true if the shard contains the window with the fingerprint
+    bool contains(std::uint64_t fingerprint) const {
+        return count == 1
+            || ((fingerprint * 0x9e3779b97f4a7c15ULL) >> 32) % count == index;
+    }
+};
+
+/*
+ * A Rabin-Karp polynomial rolling hash over token windows of a given
+ * length, computed modulo 2^64.
+ * Windows starting near each other are derived by rolling the previous
+ * window's hash, so each file's tokens are read about once.
+ */
+class WindowHasher {
+public:
+    typedef std::uint64_t fingerprint_type;
+
+private:
+    // Polynomial base; an odd value keeps all powers invertible
+    static const fingerprint_type BASE = 0x100000001b3ULL;
+
+    // Length of the hashed windows
+    unsigned length;
+
+    // BASE raised to length - 1
+    fingerprint_type top_power = 1;
+
+    // When set, only windows it reports as repeated are visited
+    const WindowSketch *sketch = nullptr;
+
+    // Only windows in this shard are visited
+    WindowShard shard;
+
+public:
+    WindowHasher(unsigned length) : length(length) {
+        for (unsigned i = 1; i < length; i++)
+            top_power *= BASE;
+    }
+
+    /*
+     * Return a well-mixed version of a polynomial hash, so that
+     * any of its bits can be used for selecting a table slot or shard
+     */
+    static fingerprint_type mix(fingerprint_type h) {
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+    // Visit only the windows the sketch reports as seen at least twice
+    void set_sketch(const WindowSketch *s) { sketch = s; }
+
+    // Visit only the windows in the specified shard
+    void set_shard(const WindowShard &s) { shard = s; }
+
+    // Return the fingerprint of the window starting at the tokens
+    fingerprint_type
+    fingerprint(FileData::tokens_type::const_iterator tokens) const {
+        fingerprint_type h = 0;
+        for (unsigned i = 0; i < length; i++)
+            h = h * BASE + tokens[i];
+        return mix(h);
+    }
+
+    /*
+     * Call fn(offset, fingerprint) for each of the file's non-empty
+     * lines that is followed by at least length tokens, in line order.
+     * These are the windows the clone detector indexes.
+     */
+    template <typename F>
+    void for_each_window(const FileData &file, F fn) const {
+        auto tokens = file.offset_begin(0);
+        fingerprint_type h = 0;
+        FileData::token_offset_type pos = 0;
+        bool have_hash = false;
+
+        for (const auto& line : file.line_view()) {
+            if (file.line_is_empty(line))
+                continue;
+            if (file.remaining_tokens(line) < length)
+                break;
+
+            auto offset = file.line_offset(line);
+            if (have_hash && offset - pos < length) {
+                // Roll the previous window's hash forward
+                for (; pos < offset; pos++)
+                    h = (h - tokens[pos] * top_power) * BASE
+                        + tokens[pos + length];
+            } else {
+                h = 0;
+                for (unsigned i = 0; i < length; i++)
+                    h = h * BASE + tokens[offset + i];
+                pos = offset;
+                have_hash = true;
+            }
+            fingerprint_type fingerprint = mix(h);
+            if ((!sketch || sketch->seen_twice(fingerprint))
+                    && shard.contains(fingerprint))
+                fn(offset, fingerprint);
+        }
+    }
+};
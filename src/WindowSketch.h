@@ -0,0 +1,96 @@
+/*-
+ * Copyright 2023 Diomidis Spinellis
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * A sketch counting window fingerprints
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * A counting Bloom filter of window fingerprints with two-bit
+ * saturating counters, which tells whether a window has been
+ * added at least twice.
+ * It never misses a repeated window, but may wrongly report
+ * a unique window as repeated.
+ * Windows can be added concurrently by multiple threads.
+ */
+class WindowSketch {
+public:
+    typedef std::uint64_t fingerprint_type;
+
+private:
+    // Number of counters examined for each window
+    static const unsigned NHASHES = 4;
+
+    // Counters per window added
+    static const unsigned COUNTERS_PER_WINDOW = 8;
+
+    // Counters packed into each word
+    static const unsigned WORD_COUNTERS = 32;
+
+    std::vector<std::atomic<std::uint64_t>> words;
+
+    // Number of counters minus one; their number is a power of two
+    std::uint64_t mask;
+
+    // Return the index of the fingerprint's i-th counter
+    std::uint64_t counter(fingerprint_type fingerprint, unsigned i) const {
+        // Double hashing of the well-mixed fingerprint
+        return (fingerprint + i * ((fingerprint >> 32) | 1)) & mask;
+    }
+
+    // Return the value of the specified counter
+    unsigned count(std::uint64_t c) const {
+        return (words[c / WORD_COUNTERS].load(std::memory_order_relaxed)
+                >> (c % WORD_COUNTERS * 2)) & 3;
+    }
+
+public:
+    // Construct a sketch suitable for up to the specified number of windows
+    WindowSketch(std::size_t nwindows) {
+        std::uint64_t ncounters = WORD_COUNTERS;
+        while (ncounters < COUNTERS_PER_WINDOW * nwindows)
+            ncounters *= 2;
+        mask = ncounters - 1;
+        words = std::vector<std::atomic<std::uint64_t>>(ncounters / WORD_COUNTERS);
+    }
+
+    // Add a window with the specified fingerprint
+    void add(fingerprint_type fingerprint) {
+        for (unsigned i = 0; i < NHASHES; i++) {
+            std::uint64_t c = counter(fingerprint, i);
+            auto& word = words[c / WORD_COUNTERS];
+            unsigned shift = c % WORD_COUNTERS * 2;
+            std::uint64_t old = word.load(std::memory_order_relaxed);
+            while (((old >> shift) & 3) < 2
+                    && !word.compare_exchange_weak(old, old + (1ULL << shift),
+                        std::memory_order_relaxed))
+                ;
+        }
+    }
+
+    // Return true if the window may have been added at least twice
+    bool seen_twice(fingerprint_type fingerprint) const {
+        for (unsigned i = 0; i < NHASHES; i++)
+            if (count(counter(fingerprint, i)) < 2)
+                return false;
+        return true;
+    }
+};
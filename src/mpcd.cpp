@@ -17,31 +17,136 @@
  *
  */
 
+#include <cctype>
+#include <chrono>
 #include <cstring>
+#include <fstream>
+#include <stdexcept>
 #include <string>
+#include <system_error>
 #include <iostream>
 #include <ostream>
+#include <vector>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "TokenContainer.h"
 #include "CloneDetector.h"
+#include "HashIndex.h"
+#include "SortIndex.h"
+#include "SpillIndex.h"
 
 const char version[] = "1.1.4";
 
 static void
 size_report()
 {
-    // Three pointers per Red-Black tree node plus color overhead
     std::cout << "Bytes per token: " << sizeof(FileData::token_type) << std::endl;
-    std::cout << "Bytes per unique line: " << sizeof(SeenTokens) + sizeof(CloneLocation) + 3 * sizeof(void *) + sizeof(int) << std::endl;
+    std::cout << "Bytes per token (line index): " << sizeof(TokenArena::token_line_type) << std::endl;
+    // Three pointers per Red-Black tree node plus color overhead
+    std::cout << "Bytes per unique line: " << sizeof(CloneDetector::candidates_type::value_type) + 4 * sizeof(void *) << std::endl;
+
+    // At most half of the hash table's slots are occupied
+    std::cout << "Bytes per unique line (hash engine): " << 2 * sizeof(HashIndex::Entry) + sizeof(CloneLocation) + sizeof(HashIndex::location_index_type) << std::endl;
+
+    std::cout << "Bytes per line (sort engine): " << 2 * sizeof(SortIndex::Record) << std::endl;
+    std::cout << "Disk bytes per line (memory limit): " << sizeof(SpillIndex::Record) << std::endl;
 
     std::cout << "Bytes per duplicate line: " << sizeof(SeenTokens) << std::endl;
     std::cout << "Bytes per file: " << sizeof(FileData) << std::endl;
 
-    std::cout << "Bytes per clone group: " << 2 * sizeof(void *) << std::endl;
-    std::cout << "Bytes per clone: " << 2 * sizeof(void *) + sizeof(Clone) << std::endl;
+    std::cout << "Bytes per clone group: " << sizeof(CloneDetector::clone_groups_type::size_type) << std::endl;
+    std::cout << "Bytes per clone: " << sizeof(Clone) << std::endl;
+}
+
+// Identify the clones among the indexed clone candidates
+static void
+detect_clones(CloneDetector &cd, bool block_regions, bool prefilter,
+        bool verbose)
+{
+    if (verbose)
+        std::cerr << "Identified "
+            << cd.get_number_of_seen_clones() << " potential clones in "
+            << cd.get_number_of_seen_sites() << " total sites."
+            << std::endl;
+
+    cd.prune_non_clones();
+    if (verbose)
+        std::cerr << "Pruned non-clone sites leaving "
+            << cd.get_number_of_seen_sites() << " sites."
+            << std::endl;
+    if (verbose && prefilter && cd.get_number_of_unique_windows() > 0)
+        std::cerr << "The prefilter indexed "
+            << cd.get_number_of_prefilter_false_positives() << " of "
+            << cd.get_number_of_unique_windows() << " unique sites"
+            << " (false positive rate "
+            << 100.0 * cd.get_number_of_prefilter_false_positives()
+                / cd.get_number_of_unique_windows()
+            << "%)." << std::endl;
+
+    if (block_regions)
+        cd.create_block_region_clones();
+    else
+        cd.create_line_region_clones();
+
+    cd.clear_clone_candidates();
+    if (verbose) {
+        std::cerr << "Identified " << cd.get_number_of_clones()
+            << " clones in " << cd.get_number_of_clone_groups() << " groups."
+            << std::endl;
+        if (cd.get_number_of_clone_groups() > 0)
+            std::cerr << "Each clone element is on average "
+                << cd.get_number_of_clone_tokens() / cd.get_number_of_clone_groups()
+                << " tokens long."
+                << std::endl;
+    }
+
+    if (!block_regions) {
+        // Extend line regions as far as possible
+        cd.extend_clones();
+        if (verbose) {
+            std::cerr << "Extended clones to their maximal size." << std::endl;
+            if (cd.get_number_of_clone_groups() > 0)
+                std::cerr << "Each clone element is on average "
+                    << cd.get_number_of_clone_tokens() / cd.get_number_of_clone_groups()
+                    << " tokens long."
+                    << std::endl;
+        }
+    }
+}
+
+// Read the clone groups of the specified shards and merge them
+static void
+merge_shards(CloneDetector &cd, const std::vector<std::string> &shard_files,
+        bool verbose)
+{
+    for (const auto& name : shard_files) {
+        std::ifstream in(name);
+        if (!in) {
+            std::cerr << "Unable to open " << name << ": "
+                << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        try {
+            cd.read_shard(in);
+        } catch (const std::runtime_error &e) {
+            std::cerr << name << ": " << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    try {
+        cd.merge_shards();
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (verbose)
+        std::cerr << "Merged " << shard_files.size() << " shards with "
+            << cd.get_number_of_clones() << " clones in "
+            << cd.get_number_of_clone_groups() << " groups."
+            << std::endl;
 }
 
 // Identify clones among the tokenized input stream
@@ -51,16 +156,93 @@ main(int argc, char * const argv[])
     int opt;
     int clone_tokens = 15; // Minimum number of same tokens to identify a clone
     bool verbose = false;
-    bool json = false;
+    ReportOptions report_options;
     bool block_regions = false;
+    bool write_binary = false;
+    bool pipelined = false;
+    bool line_index = false;
+    unsigned nthreads = 1;
+    DetectorOptions options;
+    std::vector<std::string> shard_files;
+    char *end;
 
-    while ((opt = getopt(argc, argv, "bjn:SVv")) != -1)
+    while ((opt = getopt(argc, argv, "aBbc:d:e:f:jlM:m:n:Ops:SuVvt:")) != -1)
         switch (opt) {
+        case 'a':
+            report_options.all_pairs = true;
+            break;
+        case 'B':
+            write_binary = true;
+            break;
         case 'b':
             block_regions = true;
+            options.block_regions = true;
+            break;
+        case 'c':
+            report_options.max_pairs = std::strtoull(optarg, &end, 10);
+            if (!isdigit(*optarg) || *end || report_options.max_pairs == 0) {
+                std::cerr << "Invalid number of pairs specified" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+            options.block_open = std::strtoul(optarg, &end, 10);
+            options.block_close = *end == ','
+                ? std::strtoul(end + 1, &end, 10) : options.block_open;
+            if (*end || options.block_open == options.block_close) {
+                std::cerr << "Invalid block delimiters specified" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'e':
+            if (strcmp(optarg, "map") == 0)
+                options.engine = IndexEngine::map;
+            else if (strcmp(optarg, "hash") == 0)
+                options.engine = IndexEngine::hash;
+            else if (strcmp(optarg, "sort") == 0)
+                options.engine = IndexEngine::sort;
+            else if (strcmp(optarg, "suffix") == 0)
+                options.engine = IndexEngine::suffix;
+            else {
+                std::cerr << "Unknown indexing engine " << optarg << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "text") == 0)
+                report_options.format = ReportFormat::text;
+            else if (strcmp(optarg, "json") == 0)
+                report_options.format = ReportFormat::json;
+            else if (strcmp(optarg, "ndjson") == 0)
+                report_options.format = ReportFormat::ndjson;
+            else if (strcmp(optarg, "binary") == 0)
+                report_options.format = ReportFormat::binary;
+            else if (strcmp(optarg, "pairs") == 0)
+                report_options.format = ReportFormat::pairs;
+            else if (strcmp(optarg, "binary-pairs") == 0)
+                report_options.format = ReportFormat::binary_pairs;
+            else {
+                std::cerr << "Unknown output format " << optarg << std::endl;
+                exit(EXIT_FAILURE);
+            }
             break;
         case 'j':
-            json = true;
+            report_options.format = ReportFormat::json;
+            break;
+        case 'l':
+            line_index = true;
+            break;
+        case 'M':
+            options.memory_limit = std::strtoull(optarg, &end, 10);
+            if (!isdigit(*optarg) || *end || options.memory_limit == 0
+                    || options.memory_limit > (std::size_t(-1) >> 20)) {
+                std::cerr << "Invalid memory limit specified" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            options.memory_limit <<= 20;
+            break;
+        case 'm':
+            shard_files.push_back(optarg);
             break;
         case 'n':
             clone_tokens = std::atoi(optarg);
@@ -69,9 +251,36 @@ main(int argc, char * const argv[])
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'O':
+            options.partial_overlap = true;
+            break;
+        case 'p':
+            pipelined = true;
+            break;
+        case 's':
+            options.shard.index = std::strtoul(optarg, &end, 10);
+            options.shard.count = *end == '/'
+                ? std::strtoul(end + 1, &end, 10) : 0;
+            if (*end || options.shard.count < 2
+                    || options.shard.index >= options.shard.count) {
+                std::cerr << "Invalid shard specified" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'S':
             size_report();
             exit(EXIT_SUCCESS);
+        case 't':
+            nthreads = std::strtoul(optarg, &end, 10);
+            if (!isdigit(*optarg) || *end || nthreads == 0) {
+                std::cerr << "Invalid number of threads specified" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            options.nthreads = nthreads;
+            break;
+        case 'u':
+            options.prefilter = true;
+            break;
         case 'V':
             std::cout << "mpcd " << version << std::endl;
             exit(EXIT_SUCCESS);
@@ -80,61 +289,80 @@ main(int argc, char * const argv[])
             break;
         default: /* ? */
             std::cerr << "Usage: " << argv[0] <<
-                " [-bjSVv] [-n tokens]" << std::endl;
+                " [-aBbjlOpSuVv] [-c pairs] [-d open,close] [-e engine]\n"
+                "\t[-f format] [-M megabytes] [-m shard-file] [-n tokens]\n"
+                "\t[-s shard/shards] [-t threads] [file]"
+                << std::endl;
             exit(EXIT_FAILURE);
         }
 
+    if (!shard_files.empty() && !options.shard.is_whole()) {
+        std::cerr << "Shards can't be both created and merged" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = STDIN_FILENO;
+    if (optind < argc) {
+        fd = open(argv[optind], O_RDONLY);
+        if (fd == -1) {
+            std::cerr << "Unable to open " << argv[optind] << ": "
+                << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    TokenContainer token_container;
+    if (options.memory_limit)
+        token_container.map_to_files();
+    CloneDetector cd(token_container, clone_tokens, options);
+
     if (verbose)
         std::cerr << "Reading input tokens." << std::endl;
-    TokenContainer token_container(std::cin);
+    auto read_begin = std::chrono::steady_clock::now();
+    try {
+        if (pipelined && !write_binary && shard_files.empty())
+            // Index each file as soon as it has been read
+            token_container.read(fd, nthreads, [&cd](const FileData &file) {
+                cd.index_file(file);
+            });
+        else
+            token_container.read(fd, nthreads);
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::chrono::duration<double> read_time = std::chrono::steady_clock::now() - read_begin;
     if (verbose)
         std::cerr << "Read "
             << token_container.file_size() << " files, "
             << token_container.line_size() << " lines, "
-            << token_container.token_size() << " tokens."
+            << token_container.token_size() << " tokens ("
+            << token_container.get_input_size() / 1e6 / read_time.count()
+            << " MB/s)."
             << std::endl;
 
-    CloneDetector cd(token_container, clone_tokens);
-    if (verbose)
-        std::cerr << "Identified "
-            << cd.get_number_of_seen_clones() << " potential clones in "
-            << cd.get_number_of_seen_sites() << " total sites."
-            << std::endl;
+    if (write_binary) {
+        token_container.write_binary(std::cout);
+        std::cout.flush();
+        exit(std::cout.good() ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-    cd.prune_non_clones();
-    if (verbose)
-        std::cerr << "Pruned non-clone sites leaving "
-            << cd.get_number_of_seen_sites() << " sites."
-            << std::endl;
+    if (line_index)
+        token_container.index_token_lines(nthreads);
 
-    if (block_regions)
-        cd.create_block_region_clones();
-    else
-        cd.create_line_region_clones();
-
-    cd.clear_clone_candidates();
-    if (verbose) {
-        std::cerr << "Identified " << cd.get_number_of_clones()
-            << " clones in " << cd.get_number_of_clone_groups() << " groups."
-            << std::endl;
-        if (cd.get_number_of_clone_groups() > 0)
-            std::cerr << "Each clone element is on average "
-                << cd.get_number_of_clone_tokens() / cd.get_number_of_clone_groups()
-                << " tokens long."
-                << std::endl;
+    if (!shard_files.empty())
+        merge_shards(cd, shard_files, verbose);
+    else {
+        if (!pipelined)
+            for (const auto& file : token_container.file_view())
+                cd.index_file(file);
+        detect_clones(cd, block_regions, options.prefilter, verbose);
     }
 
-    if (!block_regions) {
-        // Extend line regions as far as possible
-        cd.extend_clones();
-        if (verbose) {
-            std::cerr << "Extended clones to their maximal size." << std::endl;
-            if (cd.get_number_of_clone_groups() > 0)
-                std::cerr << "Each clone element is on average "
-                    << cd.get_number_of_clone_tokens() / cd.get_number_of_clone_groups()
-                    << " tokens long."
-                    << std::endl;
-        }
+    if (!options.shard.is_whole()) {
+        cd.write_shard(std::cout);
+        std::cout.flush();
+        exit(std::cout.good() ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
     cd.remove_shadowed_groups();
@@ -144,10 +372,14 @@ main(int argc, char * const argv[])
             << cd.get_number_of_clone_groups() << " groups."
             << std::endl;
 
-    if (json)
-        cd.report_json();
-    else
-        cd.report_text();
+    OutputWriter out(STDOUT_FILENO);
+    try {
+        cd.report(out, report_options);
+        out.flush();
+    } catch (const std::system_error &e) {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
     exit(EXIT_SUCCESS);
 }